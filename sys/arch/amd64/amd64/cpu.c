@@ -76,6 +76,7 @@
 #include <sys/memrange.h>
 #include <dev/rndvar.h>
 #include <sys/atomic.h>
+#include <sys/xcall.h>
 
 #include <uvm/uvm_extern.h>
 
@@ -241,13 +242,62 @@ cpu_vm_init(struct cpu_info *ci)
 
 void	cpu_idle_mwait_cycle(void);
 void	cpu_init_mwait(struct cpu_softc *);
+int	cpu_idle_select(struct cpu_info *, u_int64_t);
 
 u_int	cpu_mwait_size, cpu_mwait_states;
 
+/*
+ * Idle states reachable with mwait, shallowest first.  There is no
+ * ACPI _CST here to tell their real exit latencies, so each mwait
+ * C-state gets a nominal one; staying in a state for three times its
+ * latency is taken to be worth the exit.
+ */
+struct mwait_state {
+	u_int	ms_cstate;		/* mwait C-state, 1 is C1 */
+	u_int	ms_hint;		/* mwait hint */
+	u_int	ms_latency;		/* exit latency, usec */
+	u_int	ms_residency;		/* target residency, usec */
+} cpu_mwait_table[MWAIT_MAXSTATES];
+int	cpu_mwait_nstates;
+
+static const u_int cpu_mwait_latency[MWAIT_MAXSTATES] = {
+	0, 2, 10, 80, 100, 150, 200, 300
+};
+
+/*
+ * Pick the deepest idle state worth entering: its target residency
+ * has to fit both before the next clock event and in what recent
+ * idle periods predict.  Without an always running APIC timer, the
+ * states below C1 would stop the clock event, so stay out of them.
+ */
+int
+cpu_idle_select(struct cpu_info *ci, u_int64_t now)
+{
+	u_int64_t predicted;
+	int i;
+
+	predicted = ci->ci_clockev_next > now ? ci->ci_clockev_next - now : 0;
+	if (predicted > ci->ci_idle_avg)
+		predicted = ci->ci_idle_avg;
+
+	for (i = cpu_mwait_nstates - 1; i > 0; i--) {
+		if (cpu_mwait_table[i].ms_cstate > 1 &&
+		    (ci->ci_feature_tpmflags & TPM_ARAT) == 0)
+			continue;
+		if ((u_int64_t)cpu_mwait_table[i].ms_residency * 1000 <=
+		    predicted)
+			break;
+	}
+	return (i);
+}
+
 void
 cpu_idle_mwait_cycle(void)
 {
 	struct cpu_info *ci = curcpu();
+	u_int64_t now, slept;
+	u_int mwait;
+	int state;
 
 	if ((read_rflags() & PSL_I) == 0)
 		panic("idle with interrupts blocked!");
@@ -268,19 +318,39 @@ cpu_idle_mwait_cycle(void)
 	 */
 	atomic_setbits_int(&ci->ci_mwait, MWAIT_IDLING | MWAIT_ONLY);
 	if (ci->ci_schedstate.spc_whichqs == 0) {
+		now = nsecuptime();
+		state = cpu_idle_select(ci, now);
 		monitor(&ci->ci_mwait, 0, 0);
 		if ((ci->ci_mwait & MWAIT_IDLING) == MWAIT_IDLING)
-			mwait(0, 0);
+			mwait(0, cpu_mwait_table[state].ms_hint);
+
+		slept = nsecuptime() - now;
+		ci->ci_cstate_usage[state]++;
+		ci->ci_cstate_time[state] += slept;
+		/* Decaying average of the recent idle periods. */
+		ci->ci_idle_avg += slept / 8 - ci->ci_idle_avg / 8;
 	}
 
-	/* done idling; let cpu_kick() know that an IPI is required */
-	atomic_clearbits_int(&ci->ci_mwait, MWAIT_IDLING);
+	/*
+	 * Done idling; let cpu_kick() know that an IPI is required
+	 * and pick up whatever was posted through the doorbell.
+	 * Run queue work needs nothing more than the wakeup.
+	 */
+	do {
+		mwait = ci->ci_mwait;
+	} while (atomic_cas_uint(&ci->ci_mwait, mwait,
+	    mwait & ~(MWAIT_IDLING | MWAIT_DOORBELL)) != mwait);
+
+	if (mwait & MWAIT_DB_XCALL)
+		xc_ipi_handler();
 }
 
 void
 cpu_init_mwait(struct cpu_softc *sc)
 {
 	unsigned int smallest, largest, extensions, c_substates;
+	struct mwait_state *ms;
+	int c;
 
 	if ((cpu_ecxfeature & CPUIDECX_MWAIT) == 0 || cpuid_level < 0x5)
 		return;
@@ -314,11 +384,69 @@ cpu_init_mwait(struct cpu_softc *sc)
 		cpu_mwait_size = largest;
 	printf("\n");
 
+	/* list the idle states, the first time around */
+	if (cpu_mwait_nstates == 0) {
+		for (c = 1; c < MWAIT_MAXSTATES; c++) {
+			if (((cpu_mwait_states >> (4 * c)) & 0xf) == 0 &&
+			    c > 1)
+				continue;
+			ms = &cpu_mwait_table[cpu_mwait_nstates++];
+			ms->ms_cstate = c;
+			ms->ms_hint = (c - 1) << 4;
+			ms->ms_latency = cpu_mwait_latency[c];
+			ms->ms_residency = 3 * cpu_mwait_latency[c];
+		}
+	}
+
 	/* enable use of mwait; may be overriden by acpicpu later */
 	if (cpu_mwait_size > 0)
 		cpu_idle_cycle_fcn = &cpu_idle_mwait_cycle;
 }
 
+/*
+ * Return the statistics of every idle state of every cpu.
+ */
+int
+cpu_cstate_sysctl(void *oldp, size_t *oldlenp, void *newp)
+{
+	CPU_INFO_ITERATOR cii;
+	struct cpu_info *ci;
+	struct cpu_cstate cs;
+	size_t len = 0;
+	int i, error;
+
+	if (newp != NULL)
+		return (EPERM);
+
+	CPU_INFO_FOREACH(cii, ci)
+		len += cpu_mwait_nstates * sizeof(cs);
+	if (oldp == NULL) {
+		*oldlenp = len;
+		return (0);
+	}
+	if (*oldlenp < len)
+		return (ENOMEM);
+
+	len = 0;
+	CPU_INFO_FOREACH(cii, ci) {
+		for (i = 0; i < cpu_mwait_nstates; i++) {
+			memset(&cs, 0, sizeof(cs));
+			cs.cs_cpu = CPU_INFO_UNIT(ci);
+			cs.cs_hint = cpu_mwait_table[i].ms_hint;
+			cs.cs_latency = cpu_mwait_table[i].ms_latency;
+			cs.cs_residency = cpu_mwait_table[i].ms_residency;
+			cs.cs_usage = ci->ci_cstate_usage[i];
+			cs.cs_time = ci->ci_cstate_time[i];
+			error = copyout(&cs, (char *)oldp + len, sizeof(cs));
+			if (error)
+				return (error);
+			len += sizeof(cs);
+		}
+	}
+	*oldlenp = len;
+	return (0);
+}
+
 void
 cpu_attach(struct device *parent, struct device *self, void *aux)
 {
@@ -403,6 +531,7 @@ cpu_attach(struct device *parent, struct device *self, void *aux)
 		printf("(uniprocessor)\n");
 		ci->ci_flags |= CPUF_PRESENT | CPUF_SP | CPUF_PRIMARY;
 		cpu_intr_init(ci);
+		xc_init_cpu(ci);
 		identifycpu(ci);
 #ifdef MTRR
 		mem_range_attach();
@@ -415,6 +544,7 @@ cpu_attach(struct device *parent, struct device *self, void *aux)
 		printf("apid %d (boot processor)\n", caa->cpu_number);
 		ci->ci_flags |= CPUF_PRESENT | CPUF_BSP | CPUF_PRIMARY;
 		cpu_intr_init(ci);
+		xc_init_cpu(ci);
 		identifycpu(ci);
 #ifdef MTRR
 		mem_range_attach();
@@ -444,6 +574,7 @@ cpu_attach(struct device *parent, struct device *self, void *aux)
 		cpu_intr_init(ci);
 		gdt_alloc_cpu(ci);
 		sched_init_cpu(ci);
+		xc_init_cpu(ci);
 		cpu_start_secondary(ci);
 		ncpus++;
 		if (ci->ci_flags & CPUF_PRESENT) {
@@ -645,6 +776,8 @@ cpu_boot_secondary(struct cpu_info *ci)
 
 	atomic_setbits_int(&ci->ci_flags, CPUF_GO);
 
+	tsc_sync_bp(ci);
+
 	for (i = 100000; (!(ci->ci_flags & CPUF_RUNNING)) && i>0;i--) {
 		delay(10);
 	}
@@ -701,6 +834,8 @@ cpu_hatch(void *v)
 
 	while ((ci->ci_flags & CPUF_GO) == 0)
 		delay(10);
+
+	tsc_sync_ap(ci);
 #ifdef HIBERNATE
 	if ((ci->ci_flags & CPUF_PARK) != 0) {
 		atomic_clearbits_int(&ci->ci_flags, CPUF_PARK);
@@ -734,7 +869,7 @@ cpu_hatch(void *v)
 	nanouptime(&ci->ci_schedstate.spc_runtime);
 	splx(s);
 
-	SCHED_LOCK(s);
+	splsched();
 	cpu_switchto(NULL, sched_chooseproc());
 }
 
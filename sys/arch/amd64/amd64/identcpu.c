@@ -39,15 +39,20 @@
 #include <sys/param.h>
 #include <sys/systm.h>
 #include <sys/sysctl.h>
+#include <sys/timetc.h>
 
 #include "vmm.h"
 
 #include <machine/cpu.h>
 #include <machine/cpufunc.h>
+#include <machine/timetc.h>
 
 void	replacesmap(void);
 u_int64_t cpu_tsc_freq(struct cpu_info *);
 u_int64_t cpu_tsc_freq_ctr(struct cpu_info *);
+u_int	tsc_get_timecount(struct timecounter *);
+void	tsc_sync_round(struct cpu_info *, u_int64_t *, u_int64_t *,
+	    u_int64_t *);
 #if NVMM > 0
 void	cpu_check_vmm_cap(struct cpu_info *);
 #endif /* NVMM > 0 */
@@ -56,6 +61,13 @@ void	cpu_check_vmm_cap(struct cpu_info *);
 char cpu_model[48];
 int cpuspeed;
 
+struct timecounter tsc_timecounter = {
+	tsc_get_timecount, NULL, ~0u, 0, "tsc", -1000, NULL, NULL, 0, 0
+};
+
+#define TSC_SYNC_ROUNDS	1000
+volatile u_int64_t tsc_sync_val;
+
 int amd64_has_xcrypt;
 #ifdef CRYPTO
 int amd64_has_pclmul;
@@ -430,6 +442,96 @@ cpu_tsc_freq(struct cpu_info *ci)
 	return ((count - last_count) * 10);
 }
 
+/*
+ * Delay for N usec by watching the TSC.  Only used when the TSC runs
+ * at a constant rate; the primary cpu's measurement is used since a
+ * hatching cpu has not measured its own yet.
+ */
+void
+tsc_delay(int usec)
+{
+	u_int64_t interval, start;
+
+	interval = (u_int64_t)usec * cpu_info_primary.ci_tsc_freq / 1000000;
+	start = rdtsc();
+	while (rdtsc() - start < interval)
+		x86_pause();
+}
+
+u_int
+tsc_get_timecount(struct timecounter *tc)
+{
+	return (rdtsc());
+}
+
+/*
+ * Check that the TSC of a hatching cpu agrees with ours.  Each round
+ * we read our TSC, have the other cpu read its own and read ours
+ * again; if the TSCs are in sync its value falls between our two.
+ * The round with the narrowest window is the one we judge by.
+ */
+void
+tsc_sync_bp(struct cpu_info *ci)
+{
+	u_int64_t bplo, bphi, ap, window, best = ~0ULL;
+	int64_t skew = 0;
+	long rf = read_rflags();
+	int i;
+
+	if (tsc_timecounter.tc_frequency == 0)
+		return;
+
+	disable_intr();
+	for (i = 0; i < TSC_SYNC_ROUNDS; i++) {
+		tsc_sync_round(ci, &bplo, &bphi, &ap);
+		window = bphi - bplo;
+		if (window < best) {
+			best = window;
+			skew = ap - (bplo + window / 2);
+		}
+	}
+	write_rflags(rf);
+
+	if (skew < -(int64_t)best || skew > (int64_t)best) {
+		printf("%s: TSC skew %lld cycles\n", ci->ci_dev->dv_xname,
+		    (long long)skew);
+		tsc_timecounter.tc_user = 0;
+		if (tsc_timecounter.tc_quality >= 0)
+			tc_reset_quality(&tsc_timecounter, -1000);
+	}
+}
+
+void
+tsc_sync_round(struct cpu_info *ci, u_int64_t *bplo, u_int64_t *bphi,
+    u_int64_t *ap)
+{
+	*bplo = rdtsc();
+	atomic_setbits_int(&ci->ci_flags, CPUF_SYNCTSC);
+	while (ci->ci_flags & CPUF_SYNCTSC)
+		x86_pause();
+	*bphi = rdtsc();
+	*ap = tsc_sync_val;
+}
+
+/*
+ * The hatching cpu's side of tsc_sync_bp().
+ */
+void
+tsc_sync_ap(struct cpu_info *ci)
+{
+	int i;
+
+	if (tsc_timecounter.tc_frequency == 0)
+		return;
+
+	for (i = 0; i < TSC_SYNC_ROUNDS; i++) {
+		while ((ci->ci_flags & CPUF_SYNCTSC) == 0)
+			x86_pause();
+		tsc_sync_val = rdtsc();
+		atomic_clearbits_int(&ci->ci_flags, CPUF_SYNCTSC);
+	}
+}
+
 void
 identifycpu(struct cpu_info *ci)
 {
@@ -515,6 +617,23 @@ identifycpu(struct cpu_info *ci)
 
 	ci->ci_tsc_freq = cpu_tsc_freq(ci);
 
+	/*
+	 * A constant rate TSC makes a cheap timecounter.  Prefer it
+	 * over everything else if it is also invariant, i.e. keeps
+	 * counting in deep C-states; userland may then read it too.
+	 * tsc_sync_bp() demotes it again should the TSCs of the other
+	 * cpus turn out to disagree.
+	 */
+	if ((ci->ci_flags & CPUF_PRIMARY) && (ci->ci_flags & CPUF_CONST_TSC) &&
+	    ci->ci_tsc_freq != 0) {
+		tsc_timecounter.tc_frequency = ci->ci_tsc_freq;
+		if (cpu_apmi_edx & CPUIDEDX_ITSC) {
+			tsc_timecounter.tc_quality = 2000;
+			tsc_timecounter.tc_user = TC_TSC;
+		}
+		tc_init(&tsc_timecounter);
+	}
+
 	amd_cpu_cacheinfo(ci);
 
 	printf("%s: %s", ci->ci_dev->dv_xname, mycpu_model);
@@ -647,6 +766,7 @@ identifycpu(struct cpu_info *ci)
 	}
 
 	cpu_topology(ci);
+	sched_topology(ci, ci->ci_pkg_id, ci->ci_core_id);
 #if NVMM > 0
 	cpu_check_vmm_cap(ci);
 #endif /* NVMM > 0 */
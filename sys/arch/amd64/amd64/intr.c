@@ -515,7 +515,7 @@ int
 intr_handler(struct intrframe *frame, struct intrhand *ih)
 {
 	struct cpu_info *ci = curcpu();
-	int floor;
+	int floor, state;
 	int rc;
 #ifdef MULTIPROCESSOR
 	int need_lock;
@@ -530,7 +530,9 @@ intr_handler(struct intrframe *frame, struct intrhand *ih)
 #endif
 	floor = ci->ci_handled_intr_level;
 	ci->ci_handled_intr_level = ih->ih_level;
+	state = cpustate_switch(CP_INTR);
 	rc = (*ih->ih_fun)(ih->ih_arg ? ih->ih_arg : frame);
+	cpustate_switch(state);
 	ci->ci_handled_intr_level = floor;
 #ifdef MULTIPROCESSOR
 	if (need_lock)
@@ -93,10 +93,11 @@ x86_ipi_handler(void)
 	struct cpu_info *ci = curcpu();
 	u_int32_t pending;
 	int bit;
-	int floor;
+	int floor, state;
 
 	floor = ci->ci_handled_intr_level;
 	ci->ci_handled_intr_level = ci->ci_ilevel;
+	state = cpustate_switch(CP_INTR);
 
 	pending = atomic_swap_uint(&ci->ci_ipis, 0);
 	for (bit = 0; bit < X86_NIPI && pending; bit++) {
@@ -107,5 +108,6 @@ x86_ipi_handler(void)
 		}
 	}
 
+	cpustate_switch(state);
 	ci->ci_handled_intr_level = floor;
 }
@@ -40,6 +40,7 @@
 #include <sys/device.h>
 #include <sys/memrange.h>
 #include <sys/systm.h>
+#include <sys/xcall.h>
 
 #include <uvm/uvm_extern.h>
 
@@ -65,6 +66,8 @@ void x86_64_ipi_halt(struct cpu_info *);
 void x86_64_ipi_synch_fpu(struct cpu_info *);
 void x86_64_ipi_flush_fpu(struct cpu_info *);
 
+void x86_64_ipi_xcall(struct cpu_info *);
+
 #if NVMM > 0
 void x86_64_ipi_start_vmm(struct cpu_info *);
 void x86_64_ipi_stop_vmm(struct cpu_info *);
@@ -102,6 +105,7 @@ void (*ipifunc[X86_NIPI])(struct cpu_info *) =
 	NULL,
 	NULL,
 #endif
+	x86_64_ipi_xcall,
 };
 
 void
@@ -163,3 +167,18 @@ x86_64_ipi_stop_vmm(struct cpu_info *ci)
 	stop_vmm_on_cpu(ci);
 }
 #endif /* NVMM > 0 */
+
+void
+x86_64_ipi_xcall(struct cpu_info *ci)
+{
+	xc_ipi_handler();
+}
+
+void
+xc_send_ipi(struct cpu_info *ci)
+{
+	if (ci == NULL)
+		x86_broadcast_ipi(X86_IPI_XCALL);
+	else if (!cpu_doorbell(ci, MWAIT_DB_XCALL))
+		x86_send_ipi(ci, X86_IPI_XCALL);
+}
@@ -66,10 +66,11 @@ struct evcount clk_count;
 struct evcount ipi_count;
 #endif
 
-void	lapic_delay(int);
 static u_int32_t lapic_gettick(void);
 void	lapic_clockintr(void *, struct intrframe);
 void	lapic_initclocks(void);
+int	lapic_tickless_enter(int);
+int	lapic_tickless_leave(void);
 void	lapic_map(paddr_t);
 
 void lapic_hwmask(struct pic *, int);
@@ -374,54 +375,318 @@ lapic_gettick(void)
 
 #include <sys/kernel.h>		/* for hz */
 
-u_int32_t lapic_tval;
-
 /*
  * this gets us up to a 4GHz busclock....
  */
 u_int32_t lapic_per_second;
-u_int32_t lapic_frac_usec_per_cycle;
-u_int64_t lapic_frac_cycle_per_usec;
-u_int32_t lapic_delaytab[26];
+u_int64_t lapic_max_nsec;	/* longest interval the timer can count */
+u_int64_t lapic_hardclock_nsec;	/* hardclock period */
+u_int64_t lapic_statclock_nsec;	/* statclock period */
+u_int64_t lapic_statclock_var;	/* random variation of the period */
+int	lapic_tscdl;			/* timer in TSC-deadline mode */
+u_int64_t lapic_tsc_freq;		/* TSC-deadline timer frequency */
+
+void	lapic_clockev_rearm(struct cpu_info *, u_int64_t);
+int	lapic_clockev_arm(int, u_int64_t);
+int	lapic_tickless_wakeup(struct cpu_info *, u_int64_t);
+void	lapic_clockev_init(struct cpu_info *);
+void	lapic_statclock_next(struct cpu_info *, u_int64_t);
+void	lapic_setstatclockrate(int);
+
+/*
+ * Move a periodic deadline to its first multiple of period after now.
+ */
+static __inline void
+lapic_clockev_advance(u_int64_t *deadline, u_int64_t now, u_int64_t period)
+{
+	*deadline += period;
+	if (*deadline <= now)
+		*deadline += ((now - *deadline) / period + 1) * period;
+}
+
+/*
+ * Schedule the next statclock a random distance around one period
+ * after the last, so that it cannot phase-lock with hardclock or
+ * with the code it samples.
+ */
+void
+lapic_statclock_next(struct cpu_info *ci, u_int64_t now)
+{
+	u_int64_t *deadline = &ci->ci_clockev[CLKEV_STATCLOCK];
+	u_int64_t var = lapic_statclock_var;
+	u_int32_t r = ci->ci_randseed;
+
+	r ^= r << 13;
+	r ^= r >> 17;
+	r ^= r << 5;
+	ci->ci_randseed = r;
+
+	/* Do not try to make up for lost periods. */
+	if (*deadline == CLKEV_NONE || *deadline + lapic_statclock_nsec <= now)
+		*deadline = now;
+	*deadline += lapic_statclock_nsec - var / 2 + (r & (var - 1));
+}
 
 void
 lapic_clockintr(void *arg, struct intrframe frame)
 {
 	struct cpu_info *ci = curcpu();
-	int floor;
+	u_int64_t now;
+	int ev, floor, state;
 
 	floor = ci->ci_handled_intr_level;
 	ci->ci_handled_intr_level = ci->ci_ilevel;
-	hardclock((struct clockframe *)&frame);
+	state = cpustate_switch(CP_INTR);
+
+	now = nsecuptime();
+
+	if (ci->ci_clockev[CLKEV_HARDCLOCK] <= now) {
+		/*
+		 * If this cpu was tickless, this interrupt is the
+		 * last of the ticks it slept through.
+		 */
+		if (ci->ci_clockev_idle != CLKEV_NONE)
+			ci->ci_schedstate.spc_missedticks +=
+			    lapic_tickless_wakeup(ci, now) - 1;
+		else
+			lapic_clockev_advance(&ci->ci_clockev[CLKEV_HARDCLOCK],
+			    now, lapic_hardclock_nsec);
+		hardclock((struct clockframe *)&frame);
+	}
+	if (ci->ci_clockev[CLKEV_STATCLOCK] <= now) {
+		lapic_statclock_next(ci, now);
+		statclock((struct clockframe *)&frame);
+	}
+	for (ev = CLKEV_STATCLOCK + 1; ev < CLKEV_NEVENTS; ev++) {
+		if (ci->ci_clockev[ev] > now)
+			continue;
+		ci->ci_clockev[ev] = CLKEV_NONE;
+		clockev_expire(ci, ev);
+	}
+
+	lapic_clockev_rearm(ci, nsecuptime());
+
+	cpustate_switch(state);
 	ci->ci_handled_intr_level = floor;
 
 	clk_count.ec_count++;
 }
 
+/*
+ * Program the timer for the earliest armed event, or stop it if
+ * there is none.  Must be called with interrupts disabled or from
+ * the clock interrupt.
+ */
 void
-lapic_startclock(void)
+lapic_clockev_rearm(struct cpu_info *ci, u_int64_t now)
 {
+	u_int64_t next, delta;
+	int ev;
+
+	next = CLKEV_NONE;
+	for (ev = 0; ev < CLKEV_NEVENTS; ev++) {
+		if (ci->ci_clockev[ev] < next)
+			next = ci->ci_clockev[ev];
+	}
+	ci->ci_clockev_next = next;
+
+	if (next == CLKEV_NONE) {
+		if (lapic_tscdl)
+			wrmsr(MSR_TSC_DEADLINE, 0);
+		else
+			lapic_writereg(LAPIC_ICR_TIMER, 0);
+		return;
+	}
+
+	delta = next > now ? next - now : 0;
+
 	/*
-	 * Start local apic countdown timer running, in repeated mode.
-	 *
-	 * Mask the clock interrupt and set mode,
-	 * then set divisor,
-	 * then unmask and set the vector.
+	 * A TSC-deadline timer is armed with a single MSR write of the
+	 * absolute TSC value at which it should fire.
 	 */
-	lapic_writereg(LAPIC_LVTT, LAPIC_LVTT_TM|LAPIC_LVTT_M);
-	lapic_writereg(LAPIC_DCR_TIMER, LAPIC_DCRT_DIV1);
-	lapic_writereg(LAPIC_ICR_TIMER, lapic_tval);
-	lapic_writereg(LAPIC_LVTT, LAPIC_LVTT_TM|LAPIC_TIMER_VECTOR);
+	if (lapic_tscdl) {
+		delta = (delta / 1000000000) * lapic_tsc_freq +
+		    (delta % 1000000000) * lapic_tsc_freq / 1000000000;
+		wrmsr(MSR_TSC_DEADLINE, rdtsc() + delta);
+		return;
+	}
+
+	if (delta > lapic_max_nsec)
+		delta = lapic_max_nsec;
+	delta = delta * lapic_per_second / 1000000000;
+	lapic_writereg(LAPIC_ICR_TIMER, delta > 0 ? delta : 1);
+}
+
+/*
+ * Arm (or with CLKEV_NONE, disarm) a clock event on this cpu.
+ */
+int
+lapic_clockev_arm(int ev, u_int64_t deadline)
+{
+	struct cpu_info *ci = curcpu();
+	long rf = read_rflags();
+
+	disable_intr();
+	ci->ci_clockev[ev] = deadline;
+	if (deadline < ci->ci_clockev_next)
+		lapic_clockev_rearm(ci, nsecuptime());
+	write_rflags(rf);
+
+	return (1);
+}
+
+void
+lapic_startclock(void)
+{
+	struct cpu_info *ci = curcpu();
+	u_int64_t now;
+	int ev;
+
+	if (lapic_tscdl) {
+		/*
+		 * Switch to TSC-deadline mode.  The fence orders the LVT
+		 * write before the first write to the deadline MSR.
+		 */
+		lapic_writereg(LAPIC_LVTT, LAPIC_LVTT_TM_TSCDL|LAPIC_LVTT_M);
+		wrmsr(MSR_TSC_DEADLINE, 0);
+		lapic_writereg(LAPIC_LVTT,
+		    LAPIC_LVTT_TM_TSCDL|LAPIC_TIMER_VECTOR);
+		__asm volatile("mfence" : : : "memory");
+	} else {
+		/*
+		 * Start local apic countdown timer running, in one-shot mode.
+		 *
+		 * Mask the clock interrupt and set mode,
+		 * then set divisor,
+		 * then unmask and set the vector.
+		 */
+		lapic_writereg(LAPIC_LVTT, LAPIC_LVTT_TM_ONESHOT|LAPIC_LVTT_M);
+		lapic_writereg(LAPIC_DCR_TIMER, LAPIC_DCRT_DIV1);
+		lapic_writereg(LAPIC_ICR_TIMER, 0);
+		lapic_writereg(LAPIC_LVTT,
+		    LAPIC_LVTT_TM_ONESHOT|LAPIC_TIMER_VECTOR);
+	}
+
+	/* Leave it stopped if it could not be calibrated. */
+	if (lapic_hardclock_nsec == 0)
+		return;
+
+	for (ev = 0; ev < CLKEV_NEVENTS; ev++)
+		ci->ci_clockev[ev] = CLKEV_NONE;
+	ci->ci_clockev_idle = CLKEV_NONE;
+
+	now = nsecuptime();
+	ci->ci_clockev[CLKEV_HARDCLOCK] = now + lapic_hardclock_nsec;
+	if (lapic_statclock_nsec != 0)
+		lapic_statclock_next(ci, now);
+	lapic_clockev_rearm(ci, now);
 }
 
 void
 lapic_initclocks(void)
 {
+	i8254_inittimecounter_simple();
+
+	/*
+	 * Run statclock from the timer too, at the rates the RTC would,
+	 * instead of having statistics alias with hardclock.
+	 */
+	stathz = 128;
+	profhz = 1024;
+	lapic_setstatclockrate(stathz);
+
 	lapic_startclock();
+}
 
-	i8254_inittimecounter_simple();
+/*
+ * Switch between stathz and profhz.  Each cpu's statclock picks the
+ * new period up at its next interrupt.
+ */
+void
+lapic_setstatclockrate(int arg)
+{
+	u_int64_t var;
+
+	lapic_statclock_nsec = 1000000000 / arg;
+
+	/* Vary it by the largest power of two up to half of it. */
+	for (var = 1; var <= lapic_statclock_nsec / 2; var <<= 1)
+		;
+	lapic_statclock_var = var >> 1;
+}
+
+/*
+ * Stop the tick: push the hardclock deadline out by up to nticks,
+ * or drop it entirely, so that only other events wake the cpu up.
+ */
+int
+lapic_tickless_enter(int nticks)
+{
+	struct cpu_info *ci = curcpu();
+	u_int64_t *deadline = &ci->ci_clockev[CLKEV_HARDCLOCK];
+	long rf = read_rflags();
+
+	if (nticks <= 1)
+		return (0);
+
+	disable_intr();
+	ci->ci_clockev_idle = *deadline;
+	if (nticks == INT_MAX)
+		*deadline = CLKEV_NONE;
+	else
+		*deadline += (u_int64_t)(nticks - 1) * lapic_hardclock_nsec;
+	/* The statclock would only sample an idle or lone thread. */
+	ci->ci_clockev[CLKEV_STATCLOCK] = CLKEV_NONE;
+	lapic_clockev_rearm(ci, nsecuptime());
+	write_rflags(rf);
+
+	return (1);
+}
+
+/*
+ * Restart the tick and return the number of whole ticks that went
+ * by while it was stopped.
+ */
+int
+lapic_tickless_leave(void)
+{
+	struct cpu_info *ci = curcpu();
+	u_int64_t now;
+	long rf = read_rflags();
+	int missed = 0;
+
+	disable_intr();
+	/* The clock interrupt may have beaten us to it. */
+	if (ci->ci_clockev_idle != CLKEV_NONE) {
+		now = nsecuptime();
+		missed = lapic_tickless_wakeup(ci, now);
+		lapic_clockev_rearm(ci, now);
+	}
+	write_rflags(rf);
+
+	return (missed);
 }
 
+/*
+ * Put the hardclock deadline back on its grid and count the ticks
+ * whose deadline has passed since the cpu went tickless.
+ */
+int
+lapic_tickless_wakeup(struct cpu_info *ci, u_int64_t now)
+{
+	u_int64_t next = ci->ci_clockev_idle, n = 0;
+
+	ci->ci_clockev_idle = CLKEV_NONE;
+	if (next <= now) {
+		n = (now - next) / lapic_hardclock_nsec + 1;
+		next += n * lapic_hardclock_nsec;
+	}
+	ci->ci_clockev[CLKEV_HARDCLOCK] = next;
+	if (lapic_statclock_nsec != 0)
+		lapic_statclock_next(ci, now);
+
+	return (n > INT_MAX ? INT_MAX : n);
+}
 
 extern int gettick(void);	/* XXX put in header file */
 extern u_long rtclock_tval; /* XXX put in header file */
@@ -459,6 +724,20 @@ lapic_calibrate_timer(struct cpu_info *ci)
 	long rf = read_rflags();
 	int i;
 
+	/*
+	 * There is nothing to calibrate for a TSC-deadline timer:
+	 * events are armed in TSC cycles, and we know their rate.
+	 */
+	if ((cpu_ecxfeature & CPUIDECX_DEADLINE) &&
+	    (ci->ci_flags & CPUF_CONST_TSC) && ci->ci_tsc_freq != 0) {
+		lapic_tscdl = 1;
+		lapic_tsc_freq = ci->ci_tsc_freq;
+		printf("%s: apic timer in TSC-deadline mode\n",
+		    ci->ci_dev->dv_xname);
+		lapic_clockev_init(ci);
+		return;
+	}
+
 	if (mp_verbose)
 		printf("%s: calibrating local timer\n", ci->ci_dev->dv_xname);
 
@@ -500,75 +779,37 @@ lapic_calibrate_timer(struct cpu_info *ci)
 
 	if (lapic_per_second != 0) {
 		/*
-		 * reprogram the apic timer to run in periodic mode.
-		 * XXX need to program timer on other cpu's, too.
+		 * The timer is run in one-shot mode, see lapic_startclock().
+		 * Compute the longest interval it can count, so that
+		 * converting deadlines to counts cannot overflow.
 		 */
-		lapic_tval = (lapic_per_second * 2) / hz;
-		lapic_tval = (lapic_tval / 2) + (lapic_tval & 0x1);
-
-		lapic_writereg(LAPIC_LVTT, LAPIC_LVTT_TM | LAPIC_LVTT_M |
-		    LAPIC_TIMER_VECTOR);
-		lapic_writereg(LAPIC_DCR_TIMER, LAPIC_DCRT_DIV1);
-		lapic_writereg(LAPIC_ICR_TIMER, lapic_tval);
-
-		/*
-		 * Compute fixed-point ratios between cycles and
-		 * microseconds to avoid having to do any division
-		 * in lapic_delay.
-		 */
-
-		tmp = (1000000 * (u_int64_t)1 << 32) / lapic_per_second;
-		lapic_frac_usec_per_cycle = tmp;
-
-		tmp = (lapic_per_second * (u_int64_t)1 << 32) / 1000000;
-
-		lapic_frac_cycle_per_usec = tmp;
-
-		/*
-		 * Compute delay in cycles for likely short delays in usec.
-		 */
-		for (i = 0; i < 26; i++)
-			lapic_delaytab[i] = (lapic_frac_cycle_per_usec * i) >>
-			    32;
-
-		/*
-		 * Now that the timer's calibrated, use the apic timer routines
-		 * for all our timing needs..
-		 */
-		delay_func = lapic_delay;
-		initclock_func = lapic_initclocks;
+		lapic_max_nsec = 0xffffffffULL * 1000000000 / lapic_per_second;
+		lapic_clockev_init(ci);
 	}
 }
 
 /*
- * delay for N usec.
+ * Now that the timer's calibrated, use the apic timer routines for all
+ * our timing needs..  Except for delay(): the one-shot count restarts
+ * whenever the timer is rearmed, so use the TSC if it runs at a
+ * constant rate and the i8254 otherwise.
  */
-
 void
-lapic_delay(int usec)
+lapic_clockev_init(struct cpu_info *ci)
 {
-	int32_t tick, otick;
-	int64_t deltat;		/* XXX may want to be 64bit */
-
-	otick = lapic_gettick();
-
-	if (usec <= 0)
-		return;
-	if (usec <= 25)
-		deltat = lapic_delaytab[usec];
-	else
-		deltat = (lapic_frac_cycle_per_usec * usec) >> 32;
-
-	while (deltat > 0) {
-		tick = lapic_gettick();
-		if (tick > otick)
-			deltat -= lapic_tval - (tick - otick);
-		else
-			deltat -= otick - tick;
-		otick = tick;
-
-		x86_pause();
-	}
+	u_int64_t freq;
+
+	lapic_hardclock_nsec = 1000000000 / hz;
+	freq = lapic_tscdl ? lapic_tsc_freq : lapic_per_second;
+	clockev_res = freq != 0 ? (1000000000 + freq - 1) / freq : 0;
+
+	if ((ci->ci_flags & CPUF_CONST_TSC) && ci->ci_tsc_freq != 0)
+		delay_func = tsc_delay;
+	initclock_func = lapic_initclocks;
+	setstatclockrate_func = lapic_setstatclockrate;
+	tickless_enter_func = lapic_tickless_enter;
+	tickless_leave_func = lapic_tickless_leave;
+	clockev_arm_func = lapic_clockev_arm;
 }
 
 /*
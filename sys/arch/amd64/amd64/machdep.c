@@ -219,6 +219,11 @@ paddr_t avail_end;
 
 void (*delay_func)(int) = i8254_delay;
 void (*initclock_func)(void) = i8254_initclocks;
+void (*setstatclockrate_func)(int) = NULL;
+int (*tickless_enter_func)(int) = NULL;
+int (*tickless_leave_func)(void) = NULL;
+int (*clockev_arm_func)(int, u_int64_t) = NULL;
+u_int64_t clockev_res;		/* nsec per count of the event timer */
 
 /*
  * Format of boot information passed to us by 32-bit /boot
@@ -500,6 +505,8 @@ cpu_sysctl(int *name, u_int namelen, void *oldp, size_t *oldlenp, void *newp,
 		return (sysctl_rdint(oldp, oldlenp, newp, amd64_has_xcrypt));
 	case CPU_LIDSUSPEND:
 		return (sysctl_int(oldp, oldlenp, newp, newlen, &lid_suspend));
+	case CPU_CSTATE:
+		return (cpu_cstate_sysctl(oldp, oldlenp, newp));
 	default:
 		return (EOPNOTSUPP);
 	}
@@ -517,14 +524,12 @@ cpu_sysctl(int *name, u_int namelen, void *oldp, size_t *oldlenp, void *newp,
  * specified pc, psl.
  */
 void
-sendsig(sig_t catcher, int sig, int mask, u_long code, int type,
-    union sigval val)
+sendsig(sig_t catcher, int sig, int mask, const siginfo_t *ksip)
 {
 	struct proc *p = curproc;
 	struct trapframe *tf = p->p_md.md_regs;
 	struct sigacts *psp = p->p_p->ps_sigacts;
 	struct sigcontext ksc;
-	siginfo_t ksi;
 	register_t sp, scp, sip;
 	u_long sss;
 
@@ -562,11 +567,10 @@ sendsig(sig_t catcher, int sig, int mask, u_long code, int type,
 
 	sip = 0;
 	if (psp->ps_siginfo & sigmask(sig)) {
-		sip = sp - ((sizeof(ksi) + 15) & ~15);
-		sss += (sizeof(ksi) + 15) & ~15;
+		sip = sp - ((sizeof(*ksip) + 15) & ~15);
+		sss += (sizeof(*ksip) + 15) & ~15;
 
-		initsiginfo(&ksi, sig, code, type, val);
-		if (copyout(&ksi, (void *)sip, sizeof(ksi)))
+		if (copyout(ksip, (void *)sip, sizeof(*ksip)))
 			sigexit(p, SIGILL);
 	}
 	scp = sp - sss;
@@ -666,20 +670,12 @@ cpu_kick(struct cpu_info *ci)
 {
 	/* only need to kick other CPUs */
 	if (ci != curcpu()) {
-		if (cpu_mwait_size > 0) {
-			/*
-			 * If not idling, then send an IPI, else
-			 * just clear the "keep idling" bit.
-			 */
-			if ((ci->ci_mwait & MWAIT_IN_IDLE) == 0)
-				x86_send_ipi(ci, X86_IPI_NOP);
-			else
-				atomic_clearbits_int(&ci->ci_mwait,
-				    MWAIT_KEEP_IDLING);
-		} else {
-			/* no mwait, so need an IPI */
+		/*
+		 * If idling in mwait, the doorbell wakes it up,
+		 * else we need an IPI.
+		 */
+		if (!cpu_doorbell(ci, MWAIT_DB_RESCHED))
 			x86_send_ipi(ci, X86_IPI_NOP);
-		}
 	}
 }
 #endif
@@ -701,16 +697,41 @@ cpu_unidle(struct cpu_info *ci)
 {
 	if (cpu_mwait_size > 0 && (ci->ci_mwait & MWAIT_ONLY)) {
 		/*
-		 * Just clear the "keep idling" bit; if it wasn't
-		 * idling then we didn't need to do anything anyway.
+		 * Just ring the doorbell; if it wasn't idling
+		 * then we didn't need to do anything anyway.
 		 */
-		atomic_clearbits_int(&ci->ci_mwait, MWAIT_KEEP_IDLING);
+		cpu_doorbell(ci, MWAIT_DB_RESCHED);
 		return;
 	}
 
 	if (ci != curcpu())
 		x86_send_ipi(ci, X86_IPI_NOP);
 }
+
+/*
+ * Post work for a cpu idling in mwait.  The idle loop monitors
+ * ci_mwait, so the store that sets the work bits and clears
+ * MWAIT_KEEP_IDLING wakes it without an IPI; the bits are
+ * consumed when it leaves cpu_idle_mwait_cycle().  Returns 0 if
+ * the cpu was not in mwait idle and the caller must send an IPI.
+ */
+int
+cpu_doorbell(struct cpu_info *ci, u_int bits)
+{
+	u_int o;
+
+	if (cpu_mwait_size == 0)
+		return (0);
+
+	do {
+		o = ci->ci_mwait;
+		if ((o & MWAIT_IN_IDLE) == 0)
+			return (0);
+	} while (atomic_cas_uint(&ci->ci_mwait, o,
+	    (o | bits) & ~MWAIT_KEEP_IDLING) != o);
+
+	return (1);
+}
 #endif
 
 int	waittime = -1;
@@ -1728,6 +1749,40 @@ cpu_initclocks(void)
 	(*initclock_func)();
 }
 
+int
+cpu_tickless_enter(int nticks)
+{
+	if (tickless_enter_func == NULL)
+		return (0);
+	return ((*tickless_enter_func)(nticks));
+}
+
+int
+cpu_tickless_leave(void)
+{
+	return ((*tickless_leave_func)());
+}
+
+int
+cpu_clockev_arm(int ev, u_int64_t deadline)
+{
+	if (clockev_arm_func == NULL)
+		return (0);
+	return ((*clockev_arm_func)(ev, deadline));
+}
+
+/*
+ * Return how finely clock events can be placed, in nanoseconds,
+ * or 0 if there is no event timer and they run off the tick.
+ */
+u_int64_t
+cpu_clockev_res(void)
+{
+	if (clockev_arm_func == NULL)
+		return (0);
+	return (clockev_res);
+}
+
 void
 need_resched(struct cpu_info *ci)
 {
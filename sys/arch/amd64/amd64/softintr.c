@@ -35,6 +35,7 @@
  */
 
 #include <sys/param.h>
+#include <sys/systm.h>
 #include <sys/malloc.h>
 
 #include <machine/intr.h>
@@ -79,15 +80,20 @@ softintr_dispatch(int which)
 	struct cpu_info *ci = curcpu();
 	struct x86_soft_intr *si = &x86_soft_intrs[which];
 	struct x86_soft_intrhand *sih;
-	int floor;
+	int floor, state;
 
 	floor = ci->ci_handled_intr_level;
 	ci->ci_handled_intr_level = ci->ci_ilevel;
+	state = cpustate_switch(CP_INTR);
 
 	KERNEL_LOCK();
 	for (;;) {
 		mtx_enter(&si->softintr_lock);
-		sih = TAILQ_FIRST(&si->softintr_q);
+		TAILQ_FOREACH(sih, &si->softintr_q, sih_q) {
+			/* Leave handlers bound to other cpus to them. */
+			if (sih->sih_ci == NULL || sih->sih_ci == ci)
+				break;
+		}
 		if (sih == NULL) {
 			mtx_leave(&si->softintr_lock);
 			break;
@@ -103,6 +109,7 @@ softintr_dispatch(int which)
 	}
 	KERNEL_UNLOCK();
 
+	cpustate_switch(state);
 	ci->ci_handled_intr_level = floor;
 }
 
@@ -113,6 +120,19 @@ softintr_dispatch(int which)
  */
 void *
 softintr_establish(int ipl, void (*func)(void *), void *arg)
+{
+	return (softintr_establish_cpu(NULL, ipl, func, arg));
+}
+
+/*
+ * softintr_establish_cpu:	[interface]
+ *
+ *	Register a software interrupt handler that only runs on the
+ *	given cpu, which is also the only one that may schedule it.
+ */
+void *
+softintr_establish_cpu(struct cpu_info *ci, int ipl, void (*func)(void *),
+    void *arg)
 {
 	struct x86_soft_intr *si;
 	struct x86_soft_intrhand *sih;
@@ -141,6 +161,7 @@ softintr_establish(int ipl, void (*func)(void *), void *arg)
 	sih = malloc(sizeof(*sih), M_DEVBUF, M_NOWAIT);
 	if (__predict_true(sih != NULL)) {
 		sih->sih_intrhead = si;
+		sih->sih_ci = ci;
 		sih->sih_fn = func;
 		sih->sih_arg = arg;
 		sih->sih_pending = 0;
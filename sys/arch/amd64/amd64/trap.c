@@ -171,6 +171,7 @@ trap(struct trapframe *frame)
 #endif
 
 	if (!KERNELMODE(frame->tf_cs, frame->tf_rflags)) {
+		cpustate_switch(CP_SYS);
 		type |= T_USER;
 		p->p_md.md_regs = frame;
 		refreshcreds(p);
@@ -484,6 +485,7 @@ ast(struct trapframe *frame)
 
 	uvmexp.traps++;
 	KASSERT(!KERNELMODE(frame->tf_cs, frame->tf_rflags));
+	cpustate_switch(CP_SYS);
 	p->p_md.md_regs = frame;
 	refreshcreds(p);
 	uvmexp.softs++;
@@ -508,6 +510,7 @@ syscall(struct trapframe *frame)
 	register_t code, args[9], rval[2], *argp;
 
 	uvmexp.syscalls++;
+	cpustate_switch(CP_SYS);
 	p = curproc;
 
 	code = frame->tf_rax;
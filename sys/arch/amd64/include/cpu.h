@@ -134,6 +134,10 @@ struct cpu_info {
 	u_int32_t	ci_cflushsz;
 	u_int64_t	ci_tsc_freq;
 
+	u_int64_t	ci_clockev[CLKEV_NEVENTS]; /* clock event deadlines */
+	u_int64_t	ci_clockev_next;	/* deadline the timer is set for */
+	u_int64_t	ci_clockev_idle;	/* hardclock deadline at idle */
+
 	int		ci_inatomic;
 
 #define ARCH_HAVE_CPU_TOPOLOGY
@@ -151,6 +155,13 @@ struct cpu_info {
 #define	MWAIT_KEEP_IDLING	0x2	/* cleared by other cpus to wake me */
 #define	MWAIT_ONLY		0x4	/* set if all idle states use mwait */
 #define	MWAIT_IDLING	(MWAIT_IN_IDLE | MWAIT_KEEP_IDLING)
+#define	MWAIT_DB_RESCHED	0x10	/* doorbell: look at the run queues */
+#define	MWAIT_DB_XCALL		0x20	/* doorbell: cross calls pending */
+#define	MWAIT_DOORBELL	(MWAIT_DB_RESCHED | MWAIT_DB_XCALL)
+#define	MWAIT_MAXSTATES		8
+	u_int64_t	ci_idle_avg;	/* recent idle periods, nsec */
+	u_int64_t	ci_cstate_usage[MWAIT_MAXSTATES]; /* times entered */
+	u_int64_t	ci_cstate_time[MWAIT_MAXSTATES]; /* nsec resident */
 
 	int		ci_want_resched;
 
@@ -197,6 +208,8 @@ struct cpu_info {
 #define CPUF_USERSEGS_BIT	7	/* CPU has curproc's segments */
 #define CPUF_USERSEGS	(1<<CPUF_USERSEGS_BIT)		/* and FS.base */
 
+#define CPUF_SYNCTSC	0x0800		/* Synchronize TSC */
+
 #define CPUF_PRESENT	0x1000		/* CPU is present */
 #define CPUF_RUNNING	0x2000		/* CPU is running */
 #define CPUF_PAUSE	0x4000		/* CPU is paused in DDB */
@@ -245,6 +258,7 @@ void cpu_init_idle_pcbs(void);
 
 void cpu_kick(struct cpu_info *);
 void cpu_unidle(struct cpu_info *);
+int cpu_doorbell(struct cpu_info *, u_int);
 
 #define CPU_BUSY_CYCLE()	__asm volatile("pause": : : "memory")
 
@@ -341,10 +355,14 @@ extern int cpuspeed;
 /* cpu.c */
 extern u_int cpu_mwait_size;
 extern u_int cpu_mwait_states;
+int	cpu_cstate_sysctl(void *, size_t *, void *);
 
 /* identcpu.c */
 void	identifycpu(struct cpu_info *);
 int	cpu_amd64speed(int *);
+void	tsc_delay(int);
+void	tsc_sync_bp(struct cpu_info *);
+void	tsc_sync_ap(struct cpu_info *);
 
 /* machdep.c */
 void	dumpconf(void);
@@ -368,6 +386,11 @@ void	proc_trampoline(void);
 
 /* clock.c */
 extern void (*initclock_func)(void);
+extern void (*setstatclockrate_func)(int);
+extern int (*tickless_enter_func)(int);
+extern int (*tickless_leave_func)(void);
+extern int (*clockev_arm_func)(int, u_int64_t);
+extern u_int64_t clockev_res;
 void	startclocks(void);
 void	rtcstart(void);
 void	rtcstop(void);
@@ -425,7 +448,8 @@ void mp_setperf_init(void);
 #define CPU_APMHALT		11	/* halt -p hack */
 #define CPU_XCRYPT		12	/* supports VIA xcrypt in userland */
 #define CPU_LIDSUSPEND		13	/* lid close causes a suspend */
-#define CPU_MAXID		14	/* number of valid machdep ids */
+#define CPU_CSTATE		14	/* idle state statistics */
+#define CPU_MAXID		15	/* number of valid machdep ids */
 
 #define	CTL_MACHDEP_NAMES { \
 	{ 0, 0 }, \
@@ -442,8 +466,22 @@ void mp_setperf_init(void);
 	{ "apmhalt", CTLTYPE_INT }, \
 	{ "xcrypt", CTLTYPE_INT }, \
 	{ "lidsuspend", CTLTYPE_INT }, \
+	{ "cstate", CTLTYPE_STRUCT }, \
 }
 
+/*
+ * Statistics for one idle state of one cpu, as returned by the
+ * machdep.cstate sysctl.
+ */
+struct cpu_cstate {
+	u_int		cs_cpu;		/* cpu number */
+	u_int		cs_hint;	/* mwait hint */
+	u_int		cs_latency;	/* exit latency, usec */
+	u_int		cs_residency;	/* target residency, usec */
+	u_int64_t	cs_usage;	/* times entered */
+	u_int64_t	cs_time;	/* time spent in it, nsec */
+};
+
 /*
  * Default cr4 flags.
  * Doesn't really belong here, but doesn't really belong anywhere else
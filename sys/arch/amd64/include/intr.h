@@ -239,6 +239,7 @@ struct x86_soft_intrhand {
 	TAILQ_ENTRY(x86_soft_intrhand)
 		sih_q;
 	struct x86_soft_intr *sih_intrhead;
+	struct cpu_info *sih_ci;	/* only run here, unless NULL */
 	void	(*sih_fn)(void *);
 	void	*sih_arg;
 	int	sih_pending;
@@ -252,6 +253,8 @@ struct x86_soft_intr {
 };
 
 void	*softintr_establish(int, void (*)(void *), void *);
+void	*softintr_establish_cpu(struct cpu_info *, int, void (*)(void *),
+	    void *);
 void	softintr_disestablish(void *);
 void	softintr_init(void);
 void	softintr_dispatch(int);
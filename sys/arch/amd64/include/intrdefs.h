@@ -82,13 +82,14 @@
 #define X86_IPI_DDB			0x00000080
 #define X86_IPI_START_VMM		0x00000100
 #define X86_IPI_STOP_VMM		0x00000200
+#define X86_IPI_XCALL			0x00000400
 
-#define X86_NIPI			10
+#define X86_NIPI			11
 
 #define X86_IPI_NAMES { "halt IPI", "nop IPI", "FPU flush IPI", \
 			 "FPU synch IPI", "TLB shootdown IPI", \
 			 "MTRR update IPI", "setperf IPI", "ddb IPI", \
-			 "VMM start IPI", "VMM stop IPI" }
+			 "VMM start IPI", "VMM stop IPI", "xcall IPI" }
 
 #define IREENT_MAGIC	0x18041969
 
@@ -0,0 +1,12 @@
+/*	$OpenBSD$	*/
+
+#ifndef _MACHINE_TIMETC_H_
+#define _MACHINE_TIMETC_H_
+
+/*
+ * How userland reads the timecounter published in struct timekeep,
+ * the tc_user of the active timecounter.  0 means it can't.
+ */
+#define	TC_TSC		1	/* rdtsc, in sync on all cpus */
+
+#endif /* _MACHINE_TIMETC_H_ */
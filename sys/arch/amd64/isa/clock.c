@@ -227,7 +227,7 @@ gettick(void)
 
 /*
  * Wait "n" microseconds.
- * Relies on timer 1 counting down from (TIMER_FREQ / hz) at TIMER_FREQ Hz.
+ * Relies on timer 1 counting down from rtclock_tval at TIMER_FREQ Hz.
  * Note: timer had better have been programmed before this is first used!
  * (Note that we use `rate generator' mode, which counts at 1:1; `square
  * wave' mode counts at 2:1).
@@ -278,7 +278,8 @@ i8254_delay(int n)
 #endif
 	}
 
-	limit = TIMER_FREQ / hz;
+	/* The counter reloads from rtclock_tval once startclocks() ran. */
+	limit = rtclock_tval ? rtclock_tval : TIMER_FREQ / hz;
 
 	while (n > 0) {
 		tick = gettick();
@@ -602,7 +603,9 @@ resettodr(void)
 void
 setstatclockrate(int arg)
 {
-	if (initclock_func == i8254_initclocks) {
+	if (setstatclockrate_func != NULL)
+		(*setstatclockrate_func)(arg);
+	else if (initclock_func == i8254_initclocks) {
 		if (arg == stathz)
 			mc146818_write(NULL, MC_REGA,
 			    MC_BASE_32_KHz | MC_RATE_128_Hz);
@@ -564,7 +564,7 @@ vmt_tick(void *xarg)
 	vmt_update_guest_info(sc);
 	vmt_update_guest_uptime(sc);
 
-	timeout_add_sec(&sc->sc_tick, 15);
+	timeout_add_slack(&sc->sc_tick, 15 * hz, hz);
 }
 
 void
@@ -907,7 +907,7 @@ vmt_tclo_tick(void *xarg)
 	}
 
 out:
-	timeout_add_sec(&sc->sc_tclo_tick, delay);
+	timeout_add_slack(&sc->sc_tclo_tick, delay * hz, delay * hz / 2);
 }
 
 #define BACKDOOR_OP_I386(op, frame)		\
@@ -846,6 +846,10 @@ ELFNAME2(exec,fixup)(struct proc *p, struct exec_package *epp)
 		a->au_v = ap->arg_entry;
 		a++;
 
+		a->au_id = AUX_openbsd_timekeep;
+		a->au_v = p->p_p->ps_timekeep;
+		a++;
+
 		a->au_id = AUX_null;
 		a->au_v = 0;
 		a++;
@@ -196,6 +196,7 @@ main(void *framep)
 	 */
 	curproc = p = &proc0;
 	p->p_cpu = curcpu();
+	p->p_oncpu = curcpu();
 
 	/*
 	 * Initialize timeouts.
@@ -256,6 +257,9 @@ main(void *framep)
 	 */
 	kqueue_init();
 
+	/* Initialize POSIX timers. */
+	ptimer_init();
+
 	/* Create credentials. */
 	p->p_ucred = crget();
 	p->p_ucred->cr_ngroups = 1;	/* group 0 */
@@ -286,6 +290,7 @@ main(void *framep)
 	atomic_setbits_int(&p->p_flag, P_SYSTEM);
 	p->p_stat = SONPROC;
 	pr->ps_nice = NZERO;
+	pr->ps_timerslack = TIMERSLACK_DEFAULT;
 	pr->ps_emul = &emul_native;
 	strlcpy(p->p_comm, "swapper", sizeof(p->p_comm));
 
@@ -534,16 +534,16 @@ struct sysent sysent[] = {
 	    sys_nosys },			/* 233 = obsolete t32_clock_settime */
 	{ 0, 0, 0,
 	    sys_nosys },			/* 234 = obsolete t32_clock_getres */
-	{ 0, 0, 0,
-	    sys_nosys },			/* 235 = unimplemented timer_create */
-	{ 0, 0, 0,
-	    sys_nosys },			/* 236 = unimplemented timer_delete */
-	{ 0, 0, 0,
-	    sys_nosys },			/* 237 = unimplemented timer_settime */
-	{ 0, 0, 0,
-	    sys_nosys },			/* 238 = unimplemented timer_gettime */
-	{ 0, 0, 0,
-	    sys_nosys },			/* 239 = unimplemented timer_getoverrun */
+	{ 3, s(struct sys_timer_create_args), 0,
+	    sys_timer_create },			/* 235 = timer_create */
+	{ 1, s(struct sys_timer_delete_args), 0,
+	    sys_timer_delete },			/* 236 = timer_delete */
+	{ 4, s(struct sys_timer_settime_args), 0,
+	    sys_timer_settime },		/* 237 = timer_settime */
+	{ 2, s(struct sys_timer_gettime_args), 0,
+	    sys_timer_gettime },		/* 238 = timer_gettime */
+	{ 1, s(struct sys_timer_getoverrun_args), 0,
+	    sys_timer_getoverrun },		/* 239 = timer_getoverrun */
 	{ 0, 0, 0,
 	    sys_nosys },			/* 240 = obsolete t32_nanosleep */
 	{ 0, 0, 0,
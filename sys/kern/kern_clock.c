@@ -100,8 +100,36 @@ int	profprocs;
 int	ticks;
 static int psdiv, pscnt;		/* prof => stat divider */
 int	psratio;			/* ratio: prof / stat */
+int	tickless = 1;			/* stop the clock on idle cpus */
+u_int64_t cp_tick_nsec;			/* nsec in a kern.cp_time tick */
+u_int64_t hardclock_nsec;		/* nsec in a tick */
+u_int64_t ticks_next;			/* uptime when ticks is next due */
+struct mutex ticks_mtx = MUTEX_INITIALIZER(IPL_HIGH);
+struct cpuset dynticks_cpus;		/* cpus that may stop it under a thread */
+
+int	dynticks_allowed(struct cpu_info *, struct proc *);
+void	dynticks_charge(struct cpu_info *, struct proc *, int, int);
+void	itimer_charge(struct proc *, u_int64_t, int);
+void	itimer_arm(struct schedstate_percpu *, struct proc *, int);
+void	ticks_update(void);
+int	tickless_maxticks(void);
 
-void	*softclock_si;
+/*
+ * cpustate_switch() only times the cpu states if the clock is cheap to
+ * read.  A timecounter that userland may read itself, like a synced
+ * invariant TSC, takes no lock and does no I/O.  With any other,
+ * statclock samples the states and hardclock runs the virtual and
+ * profiling timers, as they always did.
+ */
+static __inline int
+cpustate_timed(void)
+{
+	return (timecounter->tc_user != 0);
+}
+
+#define	ITIMERS_SET(pr)							\
+	(timerisset(&(pr)->ps_timer[ITIMER_VIRTUAL].it_value) ||	\
+	 timerisset(&(pr)->ps_timer[ITIMER_PROF].it_value))
 
 /*
  * Initialize clock frequencies and start both clocks running.
@@ -111,15 +139,15 @@ initclocks(void)
 {
 	int i;
 
-	softclock_si = softintr_establish(IPL_SOFTCLOCK, softclock, NULL);
-	if (softclock_si == NULL)
-		panic("initclocks: unable to register softclock intr");
+	softclock_init();
 
 	/*
 	 * Set divisors to 1 (normal case) and let the machine-specific
 	 * code do its bit.
 	 */
 	psdiv = pscnt = 1;
+	hardclock_nsec = 1000000000 / hz;
+	ticks_next = nsecuptime() + hardclock_nsec;
 	cpu_initclocks();
 
 	/*
@@ -129,6 +157,7 @@ initclocks(void)
 	if (profhz == 0)
 		profhz = i;
 	psratio = profhz / i;
+	cp_tick_nsec = 1000000000 / i;
 
 	/* For very large HZ, ensure that division by 0 does not occur later */
 	if (tickadj == 0)
@@ -137,14 +166,6 @@ initclocks(void)
 	inittimecounter();
 }
 
-/*
- * hardclock does the accounting needed for ITIMER_PROF and ITIMER_VIRTUAL.
- * We don't want to send signals with psignal from hardclock because it makes
- * MULTIPROCESSOR locking very complicated. Instead, to use an idea from
- * FreeBSD, we set a flag on the thread and when it goes to return to
- * userspace it signals itself.
- */
-
 /*
  * The real-time timer, interrupting hz times per second.
  */
@@ -153,13 +174,18 @@ hardclock(struct clockframe *frame)
 {
 	struct proc *p;
 	struct cpu_info *ci = curcpu();
+	struct schedstate_percpu *spc = &ci->ci_schedstate;
+	int missed;
 
 	p = curproc;
-	if (p && ((p->p_flag & (P_SYSTEM | P_WEXIT)) == 0)) {
+	if (p && ((p->p_flag & (P_SYSTEM | P_WEXIT)) == 0) &&
+	    !cpustate_timed()) {
 		struct process *pr = p->p_p;
 
 		/*
 		 * Run current process's virtual and profile time, as needed.
+		 * We don't want to send signals with psignal from here,
+		 * see itimer_charge().
 		 */
 		if (CLKF_USERMODE(frame) &&
 		    timerisset(&pr->ps_timer[ITIMER_VIRTUAL].it_value) &&
@@ -180,25 +206,294 @@ hardclock(struct clockframe *frame)
 	if (stathz == 0)
 		statclock(frame);
 
-	if (--ci->ci_schedstate.spc_rrticks <= 0)
-		roundrobin(ci);
+	/*
+	 * Catch up with the ticks skipped while this cpu was tickless.
+	 * If it was idle, there is only idle time to charge.  If it
+	 * was running a thread in dynticks mode, this is the residual
+	 * tick and the thread gets charged for the whole period.
+	 */
+	missed = spc->spc_missedticks;
+	spc->spc_missedticks = 0;
+	if (spc->spc_schedflags & SPCF_DYNTICKS) {
+		atomic_clearbits_int(&spc->spc_schedflags,
+		    SPCF_DYNTICKS | SPCF_DYNSTALE);
+		dynticks_charge(ci, p, missed, CLKF_USERMODE(frame));
+	} else if (missed != 0 && !cpustate_timed()) {
+		if (stathz != 0)
+			missed = (u_int64_t)missed * stathz / hz;
+		spc->spc_cp_time[CP_IDLE] += missed;
+	}
 
 	/*
-	 * If we are not the primary CPU, we're not allowed to do
-	 * any more work.
+	 * Arm a quantum that setrunqueue() started from another cpu.
+	 * Without an event timer, it is up to the tick to end it.
 	 */
-	if (CPU_IS_PRIMARY(ci) == 0)
-		return;
+	if (spc->spc_rrdeadline != CLKEV_NONE) {
+		if (spc->spc_rrdeadline <= nsecuptime())
+			roundrobin(ci);
+		else if (spc->spc_schedflags & SPCF_RRARM) {
+			atomic_clearbits_int(&spc->spc_schedflags, SPCF_RRARM);
+			cpu_clockev_arm(CLKEV_ROUNDROBIN, spc->spc_rrdeadline);
+		}
+	}
 
-	tc_ticktock();
+	ticks_update();
 
 	/*
-	 * Update real-time timeout queue.
+	 * Update this CPU's real-time timeout queue.
 	 * Process callouts at a very low cpu priority, so we don't keep the
 	 * relatively high clock interrupt priority any longer than necessary.
 	 */
 	if (timeout_hardclock_update())
-		softintr_schedule(softclock_si);
+		softclock_schedule();
+
+	/*
+	 * Stop the clock again if the thread is still alone in userland.
+	 */
+	if (p != NULL && CLKF_USERMODE(frame))
+		dynticks_update(p);
+}
+
+/*
+ * Tickless idle.  An idle cpu has no use for the clock until something
+ * wakes it up, so rather than taking hz interrupts a second just to
+ * charge idle time, stop its tick and let hardclock() catch up once
+ * the cpu is awake again.  The tick stays stopped no longer than the
+ * timecounter takes to wrap, in case all cpus are idle.
+ */
+void
+tickless_idle_enter(struct cpu_info *ci)
+{
+	struct schedstate_percpu *spc = &ci->ci_schedstate;
+	int nticks, s;
+
+	if (!tickless)
+		return;
+
+	s = splclock();
+	/* Keep the tick stopped until a timeout on this cpu needs it. */
+	nticks = min(timeout_next_expiry(ci), tickless_maxticks());
+	if (nticks > 1 && cpu_tickless_enter(nticks))
+		atomic_setbits_int(&spc->spc_schedflags, SPCF_TICKLESS);
+	splx(s);
+}
+
+void
+tickless_idle_leave(struct cpu_info *ci)
+{
+	struct schedstate_percpu *spc = &ci->ci_schedstate;
+	int s;
+
+	s = splclock();
+	if (spc->spc_schedflags & SPCF_TICKLESS) {
+		atomic_clearbits_int(&spc->spc_schedflags, SPCF_TICKLESS);
+		spc->spc_missedticks += cpu_tickless_leave();
+	}
+	splx(s);
+}
+
+/*
+ * Advance ticks to the current uptime and keep the time.  Any cpu
+ * whose clock runs does it, so that the primary can be tickless too.
+ * When all cpus were, the first one to wake up catches up in bulk.
+ */
+void
+ticks_update(void)
+{
+	u_int64_t now = nsecuptime();
+	int n;
+
+	if (now < ticks_next)
+		return;
+
+	mtx_enter(&ticks_mtx);
+	if (now >= ticks_next) {
+		n = (now - ticks_next) / hardclock_nsec + 1;
+		ticks_next += n * hardclock_nsec;
+		ticks += n;
+		tc_ticktock(n);
+	}
+	mtx_leave(&ticks_mtx);
+}
+
+/*
+ * Bound a tickless period so that some cpu keeps the time before the
+ * timecounter wraps around.
+ */
+int
+tickless_maxticks(void)
+{
+	u_int64_t n;
+
+	n = tc_wrap_nsec() / hardclock_nsec;
+	return (n > INT_MAX ? INT_MAX : n);
+}
+
+/*
+ * Dynticks: a cpu in dynticks_cpus that runs a single thread in
+ * userland has nothing for hardclock to do but bookkeeping, so its
+ * clock is stopped too.  A residual tick every second keeps the
+ * accounting and the checks below from going stale.
+ */
+int
+dynticks_allowed(struct cpu_info *ci, struct proc *p)
+{
+	struct schedstate_percpu *spc = &ci->ci_schedstate;
+	struct process *pr = p->p_p;
+
+	if (!tickless || !cpuset_isset(&dynticks_cpus, ci))
+		return (0);
+	if (spc->spc_nrun != 0 || spc->spc_schedflags & SPCF_SHOULDHALT)
+		return (0);
+
+	/* Profiling samples the pc from statclock. */
+	if (pr->ps_flags & PS_PROFIL)
+		return (0);
+
+	/* Without cpustate_switch() timing, hardclock runs the itimers. */
+	if (!cpustate_timed() && ITIMERS_SET(pr))
+		return (0);
+
+	return (1);
+}
+
+/*
+ * Charge the ticks a thread ran through in dynticks mode.
+ */
+void
+dynticks_charge(struct cpu_info *ci, struct proc *p, int missed, int user)
+{
+	int cp;
+
+	/* Make up for the statclock samples that were not taken. */
+	if (stathz != 0)
+		missed = (u_int64_t)missed * stathz / hz;
+	if (missed == 0)
+		return;
+	if (user) {
+		p->p_uticks += missed;
+		cp = p->p_p->ps_nice > NZERO ? CP_NICE : CP_USER;
+	} else {
+		p->p_sticks += missed;
+		cp = CP_SYS;
+	}
+	if (!cpustate_timed())
+		ci->ci_schedstate.spc_cp_time[cp] += missed;
+}
+
+/*
+ * Called on the way back to userland: stop the clock if the thread
+ * may run alone, restart it if not.
+ */
+void
+dynticks_update(struct proc *p)
+{
+	struct cpu_info *ci = curcpu();
+	struct schedstate_percpu *spc = &ci->ci_schedstate;
+	int nticks, s;
+
+	s = splclock();
+	if (!dynticks_allowed(ci, p)) {
+		dynticks_leave(ci, p);
+		splx(s);
+		return;
+	}
+	if (spc->spc_schedflags & SPCF_DYNSTALE)
+		dynticks_leave(ci, p);
+	if ((spc->spc_schedflags & SPCF_DYNTICKS) == 0) {
+		nticks = min(hz, timeout_next_expiry(ci));
+		nticks = min(nticks, tickless_maxticks());
+		if (nticks > 1 && cpu_tickless_enter(nticks))
+			atomic_setbits_int(&spc->spc_schedflags,
+			    SPCF_DYNTICKS);
+	}
+	splx(s);
+}
+
+/*
+ * Restart the clock of a cpu in dynticks mode, charging p for the
+ * time it ran without it.
+ */
+void
+dynticks_leave(struct cpu_info *ci, struct proc *p)
+{
+	struct schedstate_percpu *spc = &ci->ci_schedstate;
+	int s;
+
+	s = splclock();
+	if (spc->spc_schedflags & SPCF_DYNTICKS) {
+		atomic_clearbits_int(&spc->spc_schedflags,
+		    SPCF_DYNTICKS | SPCF_DYNSTALE);
+		dynticks_charge(ci, p, cpu_tickless_leave(), 1);
+	}
+	splx(s);
+}
+
+/*
+ * Something changed under a cpu in dynticks mode: a timeout was
+ * added to its wheel or another thread became runnable on it.
+ * Post an AST so the way back to userland looks at it again.
+ */
+void
+dynticks_kick(struct cpu_info *ci)
+{
+	struct schedstate_percpu *spc = &ci->ci_schedstate;
+
+	if ((spc->spc_schedflags & SPCF_DYNTICKS) == 0 ||
+	    ci->ci_curproc == NULL)
+		return;
+	atomic_setbits_int(&spc->spc_schedflags, SPCF_DYNSTALE);
+	aston(ci->ci_curproc);
+	cpu_kick(ci);
+}
+
+/*
+ * Get or set the cpus allowed to run in dynticks mode, as a mask of
+ * cpu numbers.
+ */
+int
+sysctl_dynticks(void *oldp, size_t *oldlenp, void *newp, size_t newlen)
+{
+	CPU_INFO_ITERATOR cii;
+	struct cpu_info *ci;
+	int64_t mask = 0;
+	int error;
+
+	CPU_INFO_FOREACH(cii, ci) {
+		if (CPU_INFO_UNIT(ci) < 64 &&
+		    cpuset_isset(&dynticks_cpus, ci))
+			mask |= 1ULL << CPU_INFO_UNIT(ci);
+	}
+	error = sysctl_quad(oldp, oldlenp, newp, newlen, &mask);
+	if (error || newp == NULL)
+		return (error);
+
+	cpuset_clear(&dynticks_cpus);
+	CPU_INFO_FOREACH(cii, ci) {
+		if (CPU_INFO_UNIT(ci) < 64 &&
+		    (mask & (1ULL << CPU_INFO_UNIT(ci))))
+			cpuset_add(&dynticks_cpus, ci);
+	}
+	return (0);
+}
+
+/*
+ * A one-shot clock event armed with cpu_clockev_arm() has come due.
+ */
+void
+clockev_expire(struct cpu_info *ci, int ev)
+{
+	switch (ev) {
+	case CLKEV_ROUNDROBIN:
+		roundrobin(ci);
+		break;
+	case CLKEV_TIMEOUT:
+		timeout_nsec_expire();
+		break;
+	case CLKEV_ITIMER:
+		ci->ci_schedstate.spc_itdeadline = CLKEV_NONE;
+		break;
+	}
 }
 
 /*
@@ -322,6 +617,7 @@ statclock(struct clockframe *frame)
 	struct schedstate_percpu *spc = &ci->ci_schedstate;
 	struct proc *p = curproc;
 	struct process *pr;
+	int cp;
 
 	/*
 	 * Notice changes in divisor frequency, and adjust clock
@@ -348,10 +644,7 @@ statclock(struct clockframe *frame)
 		 * If this process is being profiled record the tick.
 		 */
 		p->p_uticks++;
-		if (pr->ps_nice > NZERO)
-			spc->spc_cp_time[CP_NICE]++;
-		else
-			spc->spc_cp_time[CP_USER]++;
+		cp = pr->ps_nice > NZERO ? CP_NICE : CP_USER;
 	} else {
 #ifdef GPROF
 		/*
@@ -387,15 +680,19 @@ statclock(struct clockframe *frame)
 		if (CLKF_INTR(frame)) {
 			if (p != NULL)
 				p->p_iticks++;
-			spc->spc_cp_time[CP_INTR]++;
+			cp = CP_INTR;
 		} else if (p != NULL && p != spc->spc_idleproc) {
 			p->p_sticks++;
-			spc->spc_cp_time[CP_SYS]++;
+			cp = CP_SYS;
 		} else
-			spc->spc_cp_time[CP_IDLE]++;
+			cp = CP_IDLE;
 	}
 	spc->spc_pscnt = psdiv;
 
+	/* Sample the cpu state unless cpustate_switch() times it. */
+	if (!cpustate_timed())
+		spc->spc_cp_time[cp]++;
+
 	if (p != NULL) {
 		p->p_cpticks++;
 		/*
@@ -410,6 +707,141 @@ statclock(struct clockframe *frame)
 	}
 }
 
+/*
+ * Precise cpu time accounting.  If the clock is cheap to read, every
+ * transition between user, system and interrupt work charges the
+ * nanoseconds since the previous one to the state being left, both
+ * on this cpu and to curproc.  Otherwise only the new state is noted.
+ * The previous state is returned, for interrupt handlers to go back
+ * to it.
+ */
+int
+cpustate_switch(int state)
+{
+	struct cpu_info *ci = curcpu();
+	struct schedstate_percpu *spc = &ci->ci_schedstate;
+	struct proc *p;
+	u_int64_t now, delta;
+	int old, cp, itimers, s;
+
+	if (!cpustate_timed()) {
+		old = spc->spc_cp_state;
+		spc->spc_cp_state = state;
+		spc->spc_cp_stamp = 0;
+		return (old);
+	}
+
+	s = splhigh();
+	now = nsecuptime();
+	/* No stamp if the states were not being timed until now. */
+	delta = spc->spc_cp_stamp != 0 ? now - spc->spc_cp_stamp : 0;
+	spc->spc_cp_stamp = now;
+	cp = old = spc->spc_cp_state;
+	spc->spc_cp_state = state;
+
+	p = curproc;
+	if (p == spc->spc_idleproc)
+		p = NULL;
+	itimers = p != NULL && ITIMERS_SET(p->p_p);
+	switch (old) {
+	case CP_USER:
+	case CP_NICE:
+		if (p != NULL) {
+			p->p_unsec += delta;
+			if (itimers)
+				itimer_charge(p, delta, 1);
+		}
+		break;
+	case CP_SYS:
+		if (p != NULL) {
+			p->p_snsec += delta;
+			if (itimers)
+				itimer_charge(p, delta, 0);
+		} else
+			cp = CP_IDLE;
+		break;
+	case CP_INTR:
+		if (p != NULL)
+			p->p_insec += delta;
+		break;
+	}
+	spc->spc_cp_nsec[cp] += delta;
+
+	if (itimers && state != CP_INTR)
+		itimer_arm(spc, p, state);
+	splx(s);
+
+	return (old);
+}
+
+/*
+ * Return a cpu's kern.cp_time, in statclock ticks: those statclock
+ * sampled and those cpustate_switch() timed.
+ */
+void
+cpustate_cp_time(struct cpu_info *ci, u_int64_t *cp_time)
+{
+	struct schedstate_percpu *spc = &ci->ci_schedstate;
+	int i;
+
+	for (i = 0; i < CPUSTATES; i++)
+		cp_time[i] = spc->spc_cp_time[i] +
+		    spc->spc_cp_nsec[i] / cp_tick_nsec;
+}
+
+/*
+ * Charge run time to the virtual and profiling timers of p's process.
+ * We don't want to send signals with psignal from here because it
+ * makes MULTIPROCESSOR locking very complicated.  Instead, to use an
+ * idea from FreeBSD, we set a flag on the thread and when it goes to
+ * return to userspace it signals itself.
+ */
+void
+itimer_charge(struct proc *p, u_int64_t delta, int user)
+{
+	struct process *pr = p->p_p;
+
+	if (user && timerisset(&pr->ps_timer[ITIMER_VIRTUAL].it_value) &&
+	    itimercharge(p, ITIMER_VIRTUAL, delta) == 0) {
+		atomic_setbits_int(&p->p_flag, P_ALRMPEND);
+		need_proftick(p);
+	}
+	if (timerisset(&pr->ps_timer[ITIMER_PROF].it_value) &&
+	    itimercharge(p, ITIMER_PROF, delta) == 0) {
+		atomic_setbits_int(&p->p_flag, P_PROFPEND);
+		need_proftick(p);
+	}
+}
+
+/*
+ * Arm a one-shot event for when p, about to run in state, uses up
+ * the first of its virtual and profiling timers.  The event itself
+ * does nothing: entering the clock interrupt charges the time.  A
+ * later deadline than the armed one is left for that one to redo.
+ */
+void
+itimer_arm(struct schedstate_percpu *spc, struct proc *p, int state)
+{
+	struct process *pr = p->p_p;
+	u_int64_t deadline, left, nsec = CLKEV_NONE;
+
+	if (state != CP_SYS &&
+	    timerisset(&pr->ps_timer[ITIMER_VIRTUAL].it_value) &&
+	    (left = itimerleft(p, ITIMER_VIRTUAL)) != 0)
+		nsec = left;
+	if (timerisset(&pr->ps_timer[ITIMER_PROF].it_value) &&
+	    (left = itimerleft(p, ITIMER_PROF)) != 0 && left < nsec)
+		nsec = left;
+	if (nsec == CLKEV_NONE)
+		return;
+
+	deadline = spc->spc_cp_stamp + nsec;
+	if (deadline < spc->spc_itdeadline) {
+		spc->spc_itdeadline = deadline;
+		cpu_clockev_arm(CLKEV_ITIMER, deadline);
+	}
+}
+
 /*
  * Return information about system clocks.
  */
@@ -109,9 +109,22 @@ struct filterops timer_filtops =
 
 struct	pool knote_pool;
 struct	pool kqueue_pool;
+struct	pool kqtimer_pool;
 int kq_ntimeouts = 0;
 int kq_timeoutmax = (4 * 1024);
 
+/*
+ * State of an EVFILT_TIMER knote.  Deadlines are in nanoseconds of
+ * uptime; a periodic timer's next one is kt_next plus the period, so
+ * it keeps to the grid set when it was added however late it runs.
+ */
+struct kqtimer {
+	struct timeout	kt_to;
+	uint64_t	kt_next;	/* deadline it is armed for */
+};
+
+#define	KQ_TIMER_MAXNSEC	(100000000ULL * 1000000000)	/* as itimers */
+
 #define KNOTE_ACTIVATE(kn) do {						\
 	kn->kn_status |= KN_ACTIVE;					\
 	if ((kn->kn_status & (KN_QUEUED | KN_DISABLED)) == 0)		\
@@ -122,6 +135,7 @@ int kq_timeoutmax = (4 * 1024);
 #define KN_HASH(val, mask)	(((val) ^ (val >> 8)) & (mask))
 
 extern struct filterops sig_filtops;
+extern struct filterops ptimer_filtops;
 #ifdef notyet
 extern struct filterops aio_filtops;
 #endif
@@ -137,6 +151,7 @@ struct filterops *sysfilt_ops[] = {
 	&proc_filtops,			/* EVFILT_PROC */
 	&sig_filtops,			/* EVFILT_SIGNAL */
 	&timer_filtops,			/* EVFILT_TIMER */
+	&ptimer_filtops,		/* EVFILT_PTIMER */
 };
 
 void KQREF(struct kqueue *);
@@ -166,6 +181,8 @@ kqueue_init(void)
 	    "kqueuepl", NULL);
 	pool_init(&knote_pool, sizeof(struct knote), 0, 0, PR_WAITOK,
 	    "knotepl", NULL);
+	pool_init(&kqtimer_pool, sizeof(struct kqtimer), 0, 0, PR_WAITOK,
+	    "kqtimerpl", NULL);
 }
 
 int
@@ -322,48 +339,136 @@ filt_proc(struct knote *kn, long hint)
 	return (kn->kn_fflags != 0);
 }
 
-static void
-filt_timer_timeout_add(struct knote *kn)
+/*
+ * Convert the timer's data to nanoseconds, in the units its fflags ask
+ * for.  Milliseconds if none.  An interval is clamped like itimers are,
+ * an absolute time only where it stops fitting.
+ */
+static uint64_t
+filt_timer_nsec(struct knote *kn)
+{
+	uint64_t unit, max;
+
+	switch (kn->kn_sfflags & NOTE_TIMER_UNITMASK) {
+	case NOTE_SECONDS:
+		unit = 1000000000;
+		break;
+	case NOTE_USECONDS:
+		unit = 1000;
+		break;
+	case NOTE_NSECONDS:
+		unit = 1;
+		break;
+	default:
+		unit = 1000000;
+		break;
+	}
+
+	if (kn->kn_sfflags & NOTE_ABSTIME)
+		max = ULLONG_MAX;
+	else
+		max = KQ_TIMER_MAXNSEC;
+
+	if (kn->kn_sdata <= 0)
+		return (0);
+	if ((uint64_t)kn->kn_sdata > max / unit)
+		return (max);
+	return ((uint64_t)kn->kn_sdata * unit);
+}
+
+/*
+ * The period of a periodic timer, or 0 if it fires once.
+ */
+static uint64_t
+filt_timer_period(struct knote *kn)
 {
-	struct timeval tv;
-	int tticks;
+	uint64_t nsec;
 
-	tv.tv_sec = kn->kn_sdata / 1000;
-	tv.tv_usec = (kn->kn_sdata % 1000) * 1000;
-	tticks = tvtohz(&tv);
-	timeout_add(kn->kn_hook, tticks ? tticks : 1);
+	if ((kn->kn_flags & EV_ONESHOT) || (kn->kn_sfflags & NOTE_ABSTIME))
+		return (0);
+	nsec = filt_timer_nsec(kn);
+	return (nsec != 0 ? nsec : TIMER_MINPERIOD);
 }
 
 void
 filt_timerexpire(void *knx)
 {
 	struct knote *kn = knx;
+	struct kqtimer *kt = kn->kn_hook;
+	uint64_t now, period, n;
 
-	kn->kn_data++;
-	KNOTE_ACTIVATE(kn);
+	if ((period = filt_timer_period(kn)) == 0) {
+		kn->kn_data++;
+		KNOTE_ACTIVATE(kn);
+		return;
+	}
 
-	if ((kn->kn_flags & EV_ONESHOT) == 0)
-		filt_timer_timeout_add(kn);
+	/*
+	 * Every period that ended by now is an expiration, so lateness
+	 * doesn't add up, and the next deadline stays on the grid set
+	 * when the timer was added.  We fire no sooner than
+	 * TIMER_MINPERIOD from now though; shorter periods show as
+	 * several expirations at a time.
+	 */
+	now = nsecuptime();
+	n = 1;
+	if (kt->kt_next <= now)
+		n += (now - kt->kt_next) / period;
+	kn->kn_data += n;
+	KNOTE_ACTIVATE(kn);
+	kt->kt_next += n * period;
+	timeout_at_nsec(&kt->kt_to, MAX(kt->kt_next, now + TIMER_MINPERIOD));
 }
 
 
 /*
- * data contains amount of time to sleep, in milliseconds
+ * data contains the time to sleep, in milliseconds unless the fflags
+ * ask for other units.  With NOTE_ABSTIME it is the time of day to
+ * fire at instead, and the timer fires once.
  */
 int
 filt_timerattach(struct knote *kn)
 {
-	struct timeout *to;
+	struct kqtimer *kt;
+	struct timespec rt, ut;
+	uint64_t now, nsec, period;
+	u_int units;
+
+	units = kn->kn_sfflags & NOTE_TIMER_UNITMASK;
+	if (kn->kn_sdata < 0 || (units & (units - 1)) != 0)
+		return (EINVAL);
 
 	if (kq_ntimeouts > kq_timeoutmax)
 		return (ENOMEM);
 	kq_ntimeouts++;
 
 	kn->kn_flags |= EV_CLEAR;	/* automatically set */
-	to = malloc(sizeof(*to), M_KEVENT, M_WAITOK);
-	timeout_set(to, filt_timerexpire, kn);
-	kn->kn_hook = to;
-	filt_timer_timeout_add(kn);
+	kt = pool_get(&kqtimer_pool, PR_WAITOK);
+	timeout_set(&kt->kt_to, filt_timerexpire, kn);
+	kn->kn_hook = kt;
+
+	nanouptime(&ut);
+	now = TIMESPEC_TO_NSEC(&ut);
+	nsec = filt_timer_nsec(kn);
+	if (kn->kn_sfflags & NOTE_ABSTIME) {
+		/*
+		 * Convert the time of day to uptime once; a later step
+		 * of the clock doesn't move the deadline.
+		 */
+		nanotime(&rt);
+		kt->kt_next = now;
+		if (nsec > TIMESPEC_TO_NSEC(&rt))
+			kt->kt_next += MIN(nsec - TIMESPEC_TO_NSEC(&rt),
+			    ULLONG_MAX - now);
+		timeout_at_nsec(&kt->kt_to, kt->kt_next);
+	} else if ((period = filt_timer_period(kn)) != 0) {
+		kt->kt_next = now + period;
+		timeout_at_nsec(&kt->kt_to,
+		    MAX(kt->kt_next, now + TIMER_MINPERIOD));
+	} else {
+		kt->kt_next = now + nsec;
+		timeout_at_nsec(&kt->kt_to, kt->kt_next);
+	}
 
 	return (0);
 }
@@ -371,11 +476,10 @@ filt_timerattach(struct knote *kn)
 void
 filt_timerdetach(struct knote *kn)
 {
-	struct timeout *to;
+	struct kqtimer *kt = kn->kn_hook;
 
-	to = (struct timeout *)kn->kn_hook;
-	timeout_del(to);
-	free(to, M_KEVENT, sizeof(*to));
+	timeout_del(&kt->kt_to);
+	pool_put(&kqtimer_pool, kt);
 	kq_ntimeouts--;
 }
 
@@ -54,6 +54,7 @@
 #include <sys/stat.h>
 #include <sys/conf.h>
 #include <sys/pledge.h>
+#include <sys/timetc.h>
 #ifdef SYSVSHM
 #include <sys/shm.h>
 #endif
@@ -81,6 +82,7 @@ const struct kmem_va_mode kv_exec = {
  * Map the shared signal code.
  */
 int exec_sigcode_map(struct process *, struct emul *);
+int exec_timekeep_map(struct process *);
 
 /*
  * If non-zero, stackgap_random specifies the upper limit of the random gap size
@@ -657,6 +659,9 @@ sys_execve(struct proc *p, void *v, register_t *retval)
 		crfree(ocred);
 	}
 
+	/* POSIX timers are deleted on exec, whoever we become. */
+	ptimer_deleteall(p);
+
 	if (pr->ps_flags & PS_SUGIDEXEC) {
 		int i, s = splclock();
 
@@ -671,6 +676,7 @@ sys_execve(struct proc *p, void *v, register_t *retval)
 	/* reset CPU time usage for the thread, but not the process */
 	timespecclear(&p->p_tu.tu_runtime);
 	p->p_tu.tu_uticks = p->p_tu.tu_sticks = p->p_tu.tu_iticks = 0;
+	p->p_tu.tu_unsec = p->p_tu.tu_snsec = p->p_tu.tu_insec = 0;
 
 	km_free(argp, NCARGS, &kv_exec, &kp_pageable);
 
@@ -682,6 +688,15 @@ sys_execve(struct proc *p, void *v, register_t *retval)
 	 */
 	KNOTE(&pr->ps_klist, NOTE_EXEC);
 
+	/* map the timekeep page before the aux vector points to it */
+	if (exec_timekeep_map(pr)) {
+		if (pack.ep_interp != NULL)
+			pool_put(&namei_pool, pack.ep_interp);
+		if (pack.ep_emul_arg != NULL)
+			free(pack.ep_emul_arg, M_TEMP, pack.ep_emul_argsize);
+		goto free_pack_abort;
+	}
+
 	/* setup new registers and do misc. setup. */
 	if (pack.ep_emul->e_fixup != NULL) {
 		if ((*pack.ep_emul->e_fixup)(p, &pack) != 0)
@@ -909,3 +924,55 @@ exec_sigcode_map(struct process *pr, struct emul *e)
 
 	return (0);
 }
+
+/*
+ * The timekeep page publishes the kernel's timehands, see struct
+ * timekeep.  Like the sigobject, it is an anonymous memory object that
+ * we keep a permanent reference to and map in every process, but only
+ * PROT_READ there; the kernel keeps it mapped and wired to update it
+ * from tc_windup().
+ */
+struct uvm_object *timekeep_object;
+
+int
+exec_timekeep_map(struct process *pr)
+{
+	vsize_t timekeep_sz = round_page(sizeof(struct timekeep));
+
+	if (timekeep_object == NULL) {
+		vaddr_t va = 0;
+
+		timekeep_object = uao_create(timekeep_sz, 0);
+		uao_reference(timekeep_object);	/* permanent reference */
+
+		if (uvm_map(kernel_map, &va, timekeep_sz, timekeep_object,
+		    0, 0, UVM_MAPFLAG(PROT_READ | PROT_WRITE,
+		    PROT_READ | PROT_WRITE, MAP_INHERIT_SHARE, MADV_RANDOM, 0))) {
+			uao_detach(timekeep_object);
+			timekeep_object = NULL;
+			return (ENOMEM);
+		}
+		if (uvm_fault_wire(kernel_map, va, va + timekeep_sz,
+		    PROT_READ | PROT_WRITE)) {
+			uvm_unmap(kernel_map, va, va + timekeep_sz);
+			uao_detach(timekeep_object);
+			timekeep_object = NULL;
+			return (ENOMEM);
+		}
+
+		((struct timekeep *)va)->tk_version = TK_VERSION;
+		timekeep = (struct timekeep *)va;
+		tc_update_timekeep();
+	}
+
+	pr->ps_timekeep = 0; /* no hint */
+	uao_reference(timekeep_object);
+	if (uvm_map(&pr->ps_vmspace->vm_map, &pr->ps_timekeep, timekeep_sz,
+	    timekeep_object, 0, 0, UVM_MAPFLAG(PROT_READ, PROT_READ,
+	    MAP_INHERIT_COPY, MADV_RANDOM, 0))) {
+		uao_detach(timekeep_object);
+		return (ENOMEM);
+	}
+
+	return (0);
+}
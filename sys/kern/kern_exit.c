@@ -177,6 +177,9 @@ exit1(struct proc *p, int rv, int flags)
 	p->p_siglist = 0;
 
 	if ((p->p_flag & P_THREAD) == 0) {
+		/* delete timers, with the knotes they have on our kqueues */
+		ptimer_deleteall(p);
+
 		/* close open files and release open-file table */
 		fdfree(p);
 
@@ -625,10 +625,9 @@ proc_trampoline_mp(void)
 
 	p = curproc;
 
-	SCHED_ASSERT_LOCKED();
-	__mp_unlock(&sched_lock);
-	spl0();
+	sched_switched();
 	SCHED_ASSERT_UNLOCKED();
+	spl0();
 	KERNEL_ASSERT_UNLOCKED();
 
 	KERNEL_LOCK();
@@ -178,6 +178,11 @@ const uint64_t pledge_syscalls[SYS_MAXSYSCALL] = {
 	[SYS_sigpending] = PLEDGE_STDIO,
 	[SYS_getitimer] = PLEDGE_STDIO,
 	[SYS_setitimer] = PLEDGE_STDIO,
+	[SYS_timer_create] = PLEDGE_STDIO,
+	[SYS_timer_delete] = PLEDGE_STDIO,
+	[SYS_timer_settime] = PLEDGE_STDIO,
+	[SYS_timer_gettime] = PLEDGE_STDIO,
+	[SYS_timer_getoverrun] = PLEDGE_STDIO,
 
 	/*
 	 * To support event driven programming.
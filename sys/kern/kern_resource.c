@@ -339,6 +339,9 @@ tuagg_sub(struct tusage *tup, struct proc *p)
 	tup->tu_uticks += p->p_uticks;
 	tup->tu_sticks += p->p_sticks;
 	tup->tu_iticks += p->p_iticks;
+	tup->tu_unsec += p->p_unsec;
+	tup->tu_snsec += p->p_snsec;
+	tup->tu_insec += p->p_insec;
 }
 
 /*
@@ -354,6 +357,9 @@ tuagg_unlocked(struct process *pr, struct proc *p)
 	p->p_uticks = 0;
 	p->p_sticks = 0;
 	p->p_iticks = 0;
+	p->p_unsec = 0;
+	p->p_snsec = 0;
+	p->p_insec = 0;
 }
 
 void
@@ -377,6 +383,15 @@ calctsru(struct tusage *tup, struct timespec *up, struct timespec *sp,
 	u_quad_t st, ut, it;
 	int freq;
 
+	/* Use the exact times if the transitions have been timed. */
+	if (tup->tu_unsec + tup->tu_snsec + tup->tu_insec != 0) {
+		NSEC_TO_TIMESPEC(tup->tu_unsec, up);
+		NSEC_TO_TIMESPEC(tup->tu_snsec, sp);
+		if (ip != NULL)
+			NSEC_TO_TIMESPEC(tup->tu_insec, ip);
+		return;
+	}
+
 	st = tup->tu_sticks;
 	ut = tup->tu_uticks;
 	it = tup->tu_iticks;
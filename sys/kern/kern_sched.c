@@ -32,6 +32,11 @@ void sched_kthreads_create(void *);
 
 int sched_proc_to_cpu_cost(struct cpu_info *ci, struct proc *p);
 struct proc *sched_steal_proc(struct cpu_info *);
+void sched_runq_insert(struct cpu_info *, struct proc *);
+void sched_runq_remove(struct cpu_info *, struct proc *);
+void sched_runq_kick(struct cpu_info *);
+void sched_runq_migrate(struct proc *, int, struct cpu_info *,
+    struct cpu_info *);
 
 /*
  * To help choosing which cpu should run which process we keep track
@@ -66,11 +71,19 @@ struct taskq *sbartq;
  * means "don't bother saving old state".
  *
  * cpu_switchto is supposed to atomically load the new state of the process
- * including the pcb, pmap and setting curproc, the p_cpu pointer in the
- * proc and p_stat to SONPROC. Atomically with respect to interrupts, other
- * cpus in the system must not depend on this state being consistent.
- * Therefore no locking is necessary in cpu_switchto other than blocking
- * interrupts during the context switch.
+ * including the pcb, pmap and setting curproc and p_stat to SONPROC.
+ * Atomically with respect to interrupts, other cpus in the system must
+ * not depend on this state being consistent.  Therefore no locking is
+ * necessary in cpu_switchto other than blocking interrupts during the
+ * context switch.
+ *
+ * The old proc may already be back on a run queue, put there by itself
+ * or by a wakeup on another cpu, but it must not run anywhere else until
+ * cpu_switchto has saved its state.  The cpu that picks a proc sets its
+ * p_oncpu, and the proc that runs next on that cpu clears it again in
+ * sched_switched().  Other cpus leave a proc with p_oncpu set on the run
+ * queues.  This is what lets mi_switch() do without sched_lock from the
+ * moment it starts looking for the next proc.
  */
 
 /*
@@ -83,15 +96,23 @@ sched_init_cpu(struct cpu_info *ci)
 	struct schedstate_percpu *spc = &ci->ci_schedstate;
 	int i;
 
+	mtx_init(&spc->spc_mtx, IPL_SCHED);
 	for (i = 0; i < SCHED_NQS; i++)
 		TAILQ_INIT(&spc->spc_qs[i]);
 
 	spc->spc_idleproc = NULL;
+	sched_topology(ci, 0, CPU_INFO_UNIT(ci));
+	spc->spc_cp_state = CP_SYS;
+	spc->spc_rrdeadline = CLKEV_NONE;
+	spc->spc_itdeadline = CLKEV_NONE;
+	spc->spc_cp_stamp = nsecuptime();
 
 	kthread_create_deferred(sched_kthreads_create, ci);
 
 	LIST_INIT(&spc->spc_deadproc);
 
+	timeout_startup_cpu(ci);
+
 	/*
 	 * Slight hack here until the cpuset code handles cpu_info
 	 * structures.
@@ -171,14 +192,16 @@ sched_idle(void *v)
 			if (spc->spc_schedflags & SPCF_SHOULDHALT &&
 			    (spc->spc_schedflags & SPCF_HALTED) == 0) {
 				cpuset_del(&sched_idle_cpus, ci);
-				SCHED_LOCK(s);
+				mtx_enter(&spc->spc_mtx);
 				atomic_setbits_int(&spc->spc_schedflags,
 				    spc->spc_whichqs ? 0 : SPCF_HALTED);
-				SCHED_UNLOCK(s);
+				mtx_leave(&spc->spc_mtx);
 				wakeup(spc);
 			}
 #endif
+			tickless_idle_enter(ci);
 			cpu_idle_cycle();
+			tickless_idle_leave(ci);
 		}
 		cpu_idle_leave();
 		cpuset_del(&sched_idle_cpus, ci);
@@ -202,7 +225,9 @@ sched_exit(struct proc *p)
 	struct schedstate_percpu *spc = &curcpu()->ci_schedstate;
 	struct timespec ts;
 	struct proc *idle;
-	int s;
+
+	dynticks_leave(curcpu(), p);
+	cpustate_switch(CP_SYS);
 
 	nanouptime(&ts);
 	timespecsub(&ts, &spc->spc_runtime, &ts);
@@ -213,15 +238,26 @@ sched_exit(struct proc *p)
 	/* This process no longer needs to hold the kernel lock. */
 	KERNEL_UNLOCK();
 
-	SCHED_LOCK(s);
+	splsched();
 	idle = spc->spc_idleproc;
-	idle->p_stat = SRUN;
+	idle->p_stat = SONPROC;
+	idle->p_oncpu = curcpu();
+	spc->spc_prevproc = NULL;
 	cpu_switchto(NULL, idle);
 	panic("cpu_switchto returned");
 }
 
 /*
  * Run queue management.
+ *
+ * A cpu's run queues, spc_whichqs, spc_nrun and its bit in
+ * sched_queued_cpus are protected by its spc_mtx.  So are p_cpu and
+ * p_priority of the procs on those queues, and taking a proc off to
+ * run it, which sets p_stat to SONPROC.  sched_lock is only needed
+ * for the state that decides when a proc goes on a run queue: the
+ * sleep queues and the other p_stat changes.  It is taken before any
+ * spc_mtx.  Code that holds two run queues at once, to move a proc
+ * between cpus, takes them in CPU_INFO_UNIT order.
  */
 void
 sched_init_runqueues(void)
@@ -234,98 +270,285 @@ sched_init_runqueues(void)
 #endif
 }
 
+#ifdef MULTIPROCESSOR
+static void
+sched_runq_lock2(struct cpu_info *a, struct cpu_info *b)
+{
+	struct cpu_info *t;
+
+	if (CPU_INFO_UNIT(a) > CPU_INFO_UNIT(b)) {
+		t = a;
+		a = b;
+		b = t;
+	}
+	mtx_enter(&a->ci_schedstate.spc_mtx);
+	if (a != b)
+		mtx_enter(&b->ci_schedstate.spc_mtx);
+}
+
+static void
+sched_runq_unlock2(struct cpu_info *a, struct cpu_info *b)
+{
+	struct cpu_info *t;
+
+	if (CPU_INFO_UNIT(a) > CPU_INFO_UNIT(b)) {
+		t = a;
+		a = b;
+		b = t;
+	}
+	if (a != b)
+		mtx_leave(&b->ci_schedstate.spc_mtx);
+	mtx_leave(&a->ci_schedstate.spc_mtx);
+}
+
+/*
+ * Is p on queue of ci's run queues?  Only compares pointers, so p may
+ * be a proc that was seen there earlier and has since exited.
+ */
+static int
+sched_runq_onqueue(struct cpu_info *ci, int queue, struct proc *p)
+{
+	struct schedstate_percpu *spc = &ci->ci_schedstate;
+	struct proc *q;
+
+	MUTEX_ASSERT_LOCKED(&spc->spc_mtx);
+	TAILQ_FOREACH(q, &spc->spc_qs[queue], p_runq) {
+		if (q == p)
+			return (1);
+	}
+	return (0);
+}
+#endif
+
+/*
+ * May ci take p off a run queue to run it?  Not while another cpu is
+ * still switching away from it.
+ */
+static __inline int
+sched_proc_ready(struct cpu_info *ci, struct proc *p)
+{
+#ifdef MULTIPROCESSOR
+	struct cpu_info *oncpu = p->p_oncpu;
+
+	return (oncpu == NULL || oncpu == ci);
+#else
+	return (1);
+#endif
+}
+
 void
-setrunqueue(struct proc *p)
+sched_runq_insert(struct cpu_info *ci, struct proc *p)
 {
-	struct schedstate_percpu *spc;
+	struct schedstate_percpu *spc = &ci->ci_schedstate;
 	int queue = p->p_priority >> 2;
 
-	SCHED_ASSERT_LOCKED();
-	spc = &p->p_cpu->ci_schedstate;
+	MUTEX_ASSERT_LOCKED(&spc->spc_mtx);
 	spc->spc_nrun++;
 
 	TAILQ_INSERT_TAIL(&spc->spc_qs[queue], p, p_runq);
 	spc->spc_whichqs |= (1 << queue);
-	cpuset_add(&sched_queued_cpus, p->p_cpu);
-
-	if (cpuset_isset(&sched_idle_cpus, p->p_cpu))
-		cpu_unidle(p->p_cpu);
+	cpuset_add(&sched_queued_cpus, ci);
 }
 
 void
-remrunqueue(struct proc *p)
+sched_runq_remove(struct cpu_info *ci, struct proc *p)
 {
-	struct schedstate_percpu *spc;
+	struct schedstate_percpu *spc = &ci->ci_schedstate;
 	int queue = p->p_priority >> 2;
 
-	SCHED_ASSERT_LOCKED();
-	spc = &p->p_cpu->ci_schedstate;
+	MUTEX_ASSERT_LOCKED(&spc->spc_mtx);
 	spc->spc_nrun--;
 
 	TAILQ_REMOVE(&spc->spc_qs[queue], p, p_runq);
 	if (TAILQ_EMPTY(&spc->spc_qs[queue])) {
 		spc->spc_whichqs &= ~(1 << queue);
 		if (spc->spc_whichqs == 0)
-			cpuset_del(&sched_queued_cpus, p->p_cpu);
+			cpuset_del(&sched_queued_cpus, ci);
+	}
+}
+
+/*
+ * Take p off ci's run queue to run it on this cpu.
+ */
+static void
+sched_runq_pick(struct cpu_info *ci, struct proc *p)
+{
+	KASSERT(p->p_stat == SRUN);
+	sched_runq_remove(ci, p);
+	p->p_cpu = curcpu();
+	p->p_oncpu = curcpu();
+	p->p_stat = SONPROC;
+}
+
+/*
+ * Let a cpu know that something was put on its run queue.
+ */
+void
+sched_runq_kick(struct cpu_info *ci)
+{
+	roundrobin_arm(ci);
+
+	if (cpuset_isset(&sched_idle_cpus, ci))
+		cpu_unidle(ci);
+	else
+		dynticks_kick(ci);
+}
+
+void
+setrunqueue(struct proc *p)
+{
+	struct cpu_info *ci = p->p_cpu;
+	struct schedstate_percpu *spc = &ci->ci_schedstate;
+
+	mtx_enter(&spc->spc_mtx);
+	sched_runq_insert(ci, p);
+	mtx_leave(&spc->spc_mtx);
+
+	sched_runq_kick(ci);
+}
+
+/*
+ * Change the priority of a proc that was seen on a run queue, moving
+ * it to the queue for its new priority.  A cpu may have taken it off
+ * to run it meanwhile, then only the priority changes.
+ */
+void
+sched_setpriority(struct proc *p, u_char prio)
+{
+	struct schedstate_percpu *spc;
+	struct cpu_info *ci;
+
+	SCHED_ASSERT_LOCKED();
+
+	/* Another cpu may steal p until we hold its run queue. */
+	for (;;) {
+		ci = p->p_cpu;
+		spc = &ci->ci_schedstate;
+		mtx_enter(&spc->spc_mtx);
+		if (p->p_cpu == ci)
+			break;
+		mtx_leave(&spc->spc_mtx);
+	}
+
+	if (p->p_stat == SRUN) {
+		sched_runq_remove(ci, p);
+		p->p_priority = prio;
+		sched_runq_insert(ci, p);
+	} else
+		p->p_priority = prio;
+	mtx_leave(&spc->spc_mtx);
+}
+
+#ifdef MULTIPROCESSOR
+/*
+ * Move p, seen on queue of from's run queues, to to's run queue.
+ */
+void
+sched_runq_migrate(struct proc *p, int queue, struct cpu_info *from,
+    struct cpu_info *to)
+{
+	sched_runq_lock2(from, to);
+	if (!sched_runq_onqueue(from, queue, p)) {
+		sched_runq_unlock2(from, to);
+		return;
+	}
+	sched_runq_remove(from, p);
+	p->p_cpu = to;
+	sched_runq_insert(to, p);
+	sched_runq_unlock2(from, to);
+
+	sched_runq_kick(to);
+}
+#endif
+
+/*
+ * Called by a proc that cpu_switchto() just put on this cpu.  The proc
+ * it switched away from is saved now and may run on another cpu.
+ */
+void
+sched_switched(void)
+{
+	struct schedstate_percpu *spc = &curcpu()->ci_schedstate;
+	struct proc *prev = spc->spc_prevproc;
+
+	spc->spc_prevproc = NULL;
+	if (prev != NULL) {
+		membar_exit();
+		prev->p_oncpu = NULL;
 	}
 }
 
 struct proc *
 sched_chooseproc(void)
 {
-	struct schedstate_percpu *spc = &curcpu()->ci_schedstate;
+	struct cpu_info *ci = curcpu();
+	struct schedstate_percpu *spc = &ci->ci_schedstate;
 	struct proc *p;
+	uint32_t whichqs;
 	int queue;
 
-	SCHED_ASSERT_LOCKED();
-
 #ifdef MULTIPROCESSOR
 	if (spc->spc_schedflags & SPCF_SHOULDHALT) {
-		if (spc->spc_whichqs) {
-			for (queue = 0; queue < SCHED_NQS; queue++) {
-				while ((p = TAILQ_FIRST(&spc->spc_qs[queue]))) {
-					remrunqueue(p);
-					p->p_cpu = sched_choosecpu(p);
-					KASSERT(p->p_cpu != curcpu());
-					setrunqueue(p);
-				}
+		struct cpu_info *to;
+
+		for (;;) {
+			mtx_enter(&spc->spc_mtx);
+			if (spc->spc_whichqs == 0) {
+				mtx_leave(&spc->spc_mtx);
+				break;
 			}
+			queue = ffs(spc->spc_whichqs) - 1;
+			p = TAILQ_FIRST(&spc->spc_qs[queue]);
+			to = sched_choosecpu(p);
+			mtx_leave(&spc->spc_mtx);
+
+			KASSERT(to != ci);
+			sched_runq_migrate(p, queue, ci, to);
 		}
 		p = spc->spc_idleproc;
 		KASSERT(p);
 		KASSERT(p->p_wchan == NULL);
-		p->p_stat = SRUN;
+		p->p_stat = SONPROC;
+		p->p_oncpu = ci;
 		return (p);
 	}
 #endif
 
 again:
-	if (spc->spc_whichqs) {
-		queue = ffs(spc->spc_whichqs) - 1;
-		p = TAILQ_FIRST(&spc->spc_qs[queue]);
-		remrunqueue(p);
+	p = NULL;
+	mtx_enter(&spc->spc_mtx);
+	for (whichqs = spc->spc_whichqs; whichqs != 0 && p == NULL;
+	    whichqs &= ~(1 << queue)) {
+		queue = ffs(whichqs) - 1;
+		TAILQ_FOREACH(p, &spc->spc_qs[queue], p_runq) {
+			if (sched_proc_ready(ci, p))
+				break;
+		}
+	}
+	if (p != NULL) {
+		sched_runq_pick(ci, p);
+		mtx_leave(&spc->spc_mtx);
 		sched_noidle++;
-		KASSERT(p->p_stat == SRUN);
-	} else if ((p = sched_steal_proc(curcpu())) == NULL) {
-		p = spc->spc_idleproc;
-		if (p == NULL) {
-                        int s;
-			/*
-			 * We get here if someone decides to switch during
-			 * boot before forking kthreads, bleh.
-			 * This is kind of like a stupid idle loop.
-			 */
-#ifdef MULTIPROCESSOR
-			__mp_unlock(&sched_lock);
-#endif
-			spl0();
-			delay(10);
-			SCHED_LOCK(s);
-			goto again;
-                }
-		KASSERT(p);
-		p->p_stat = SRUN;
-	} 
+	} else {
+		mtx_leave(&spc->spc_mtx);
+		if ((p = sched_steal_proc(ci)) == NULL) {
+			p = spc->spc_idleproc;
+			if (p == NULL) {
+				int s;
+				/*
+				 * We get here if someone decides to switch
+				 * during boot before forking kthreads, bleh.
+				 * This is kind of like a stupid idle loop.
+				 */
+				s = spl0();
+				delay(10);
+				splx(s);
+				goto again;
+			}
+			p->p_stat = SONPROC;
+			p->p_oncpu = ci;
+		}
+	}
 
 	KASSERT(p->p_wchan == NULL);
 	return (p);	
@@ -453,6 +676,12 @@ sched_choosecpu(struct proc *p)
 
 /*
  * Attempt to steal a proc from some cpu.
+ *
+ * Prefer one close by: on an SMT sibling, then in our own package,
+ * and only go further away if there's nothing nearer.  The candidates
+ * are looked at one run queue at a time.  The chosen one is then taken
+ * with both run queues held, if it is still queued where we saw it and
+ * nothing showed up on our own queue meanwhile, which we'd rather run.
  */
 struct proc *
 sched_steal_proc(struct cpu_info *self)
@@ -460,42 +689,67 @@ sched_steal_proc(struct cpu_info *self)
 	struct proc *best = NULL;
 #ifdef MULTIPROCESSOR
 	struct schedstate_percpu *spc;
-	int bestcost = INT_MAX;
-	struct cpu_info *ci;
+	struct cpu_info *ci, *bestci = NULL;
+	int bestcost = INT_MAX, bestlevel = SCHED_TOPO_SYSTEM;
+	int bestqueue = 0;
 	struct cpuset set;
 
 	KASSERT((self->ci_schedstate.spc_schedflags & SPCF_SHOULDHALT) == 0);
 
 	cpuset_copy(&set, &sched_queued_cpus);
+	cpuset_del(&set, self);
 
 	while ((ci = cpuset_first(&set)) != NULL) {
 		struct proc *p;
 		int queue;
 		int cost;
+		int level;
 
 		cpuset_del(&set, ci);
 
+		level = sched_topology_level(self, ci);
+		if (best != NULL && level > bestlevel)
+			continue;
+
 		spc = &ci->ci_schedstate;
 
+		mtx_enter(&spc->spc_mtx);
+		if (spc->spc_whichqs == 0) {
+			mtx_leave(&spc->spc_mtx);
+			continue;
+		}
 		queue = ffs(spc->spc_whichqs) - 1;
 		TAILQ_FOREACH(p, &spc->spc_qs[queue], p_runq) {
 			if (p->p_flag & P_CPUPEG)
 				continue;
+			if (!sched_proc_ready(self, p))
+				continue;
 
 			cost = sched_proc_to_cpu_cost(self, p);
 
-			if (best == NULL || cost < bestcost) {
+			if (best == NULL || level < bestlevel ||
+			    (level == bestlevel && cost < bestcost)) {
 				best = p;
+				bestci = ci;
+				bestqueue = queue;
 				bestcost = cost;
+				bestlevel = level;
 			}
 		}
+		mtx_leave(&spc->spc_mtx);
 	}
 	if (best == NULL)
 		return (NULL);
 
-	spc = &best->p_cpu->ci_schedstate;
-	remrunqueue(best);
-	best->p_cpu = self;
+	sched_runq_lock2(self, bestci);
+	if (self->ci_schedstate.spc_whichqs != 0 ||
+	    !sched_runq_onqueue(bestci, bestqueue, best) ||
+	    !sched_proc_ready(self, best)) {
+		sched_runq_unlock2(self, bestci);
+		return (NULL);
+	}
+	sched_runq_pick(bestci, best);
+	sched_runq_unlock2(self, bestci);
 
 	sched_stolen++;
 #endif
@@ -532,6 +786,7 @@ int sched_cost_load = 1;
 int sched_cost_priority = 1;
 int sched_cost_runnable = 3;
 int sched_cost_resident = 1;
+int sched_cost_package = 3;
 #endif
 
 int
@@ -541,8 +796,10 @@ sched_proc_to_cpu_cost(struct cpu_info *ci, struct proc *p)
 #ifdef MULTIPROCESSOR
 	struct schedstate_percpu *spc;
 	int l2resident = 0;
+	int level;
 
 	spc = &ci->ci_schedstate;
+	level = sched_topology_level(ci, p->p_cpu);
 
 	/*
 	 * First, account for the priority of the proc we want to move.
@@ -571,19 +828,65 @@ sched_proc_to_cpu_cost(struct cpu_info *ci, struct proc *p)
 	 */
 	cost += ((sched_cost_load * spc->spc_ldavg) >> FSHIFT);
 
+	/*
+	 * Leaving the package means leaving the L3 behind too.
+	 */
+	if (level == SCHED_TOPO_SYSTEM)
+		cost += sched_cost_package;
+
 	/*
 	 * If the proc is on this cpu already, lower the cost by how much
-	 * it has been running and an estimate of its footprint.
+	 * it has been running and an estimate of its footprint.  An SMT
+	 * sibling shares those caches, so it gets the same credit, and
+	 * another core in the package, still holding it in L3, gets half.
 	 */
-	if (p->p_cpu == ci && p->p_slptime == 0) {
+	if (level != SCHED_TOPO_SYSTEM && p->p_slptime == 0) {
 		l2resident =
 		    log2(pmap_resident_count(p->p_vmspace->vm_map.pmap));
+		if (level == SCHED_TOPO_PKG)
+			l2resident /= 2;
 		cost -= l2resident * sched_cost_resident;
 	}
 #endif
 	return (cost);
 }
 
+/*
+ * Record where a cpu sits in the machine: which package it is in and
+ * which core within that package.  SMT siblings share both.  Until
+ * the MD code knows better every cpu is its own core in one package.
+ */
+void
+sched_topology(struct cpu_info *ci, u_int pkg, u_int core)
+{
+	struct schedstate_percpu *spc = &ci->ci_schedstate;
+
+	spc->spc_pkg_id = pkg;
+	spc->spc_core_id = core;
+}
+
+/*
+ * How much two cpus share; see the SCHED_TOPO_* levels.
+ */
+int
+sched_topology_level(struct cpu_info *a, struct cpu_info *b)
+{
+	struct schedstate_percpu *spa, *spb;
+
+	if (a == b)
+		return (SCHED_TOPO_CPU);
+	if (b == NULL)
+		return (SCHED_TOPO_SYSTEM);
+
+	spa = &a->ci_schedstate;
+	spb = &b->ci_schedstate;
+	if (spa->spc_pkg_id != spb->spc_pkg_id)
+		return (SCHED_TOPO_SYSTEM);
+	if (spa->spc_core_id != spb->spc_core_id)
+		return (SCHED_TOPO_PKG);
+	return (SCHED_TOPO_CORE);
+}
+
 /*
  * Peg a proc to a cpu.
  */
@@ -651,6 +954,7 @@ sched_stop_secondary_cpus(void)
 			sleep_finish(&sls,
 			    (spc->spc_schedflags & SPCF_HALTED) == 0);
 		}
+		timeout_migrate(ci);
 	}
 }
 
@@ -248,5 +248,5 @@ sensor_task_work(void *xst)
 	if (period == 0)
 		free(st, M_DEVBUF, sizeof(*st));
 	else 
-		timeout_add_sec(&st->timeout, period);
+		timeout_add_slack(&st->timeout, period * hz, hz / 2);
 }
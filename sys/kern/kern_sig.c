@@ -811,24 +811,23 @@ trapsignal(struct proc *p, int signum, u_long trapno, int code,
 {
 	struct process *pr = p->p_p;
 	struct sigacts *ps = pr->ps_sigacts;
+	siginfo_t si;
 	int mask;
 
 	mask = sigmask(signum);
 	if ((pr->ps_flags & PS_TRACED) == 0 &&
 	    (ps->ps_sigcatch & mask) != 0 &&
 	    (p->p_sigmask & mask) == 0) {
+		initsiginfo(&si, signum, trapno, code, sigval);
 #ifdef KTRACE
 		if (KTRPOINT(p, KTR_PSIG)) {
-			siginfo_t si;
-
-			initsiginfo(&si, signum, trapno, code, sigval);
 			ktrpsig(p, signum, ps->ps_sigact[signum],
 			    p->p_sigmask, code, &si);
 		}
 #endif
 		p->p_ru.ru_nsignals++;
 		(*pr->ps_emul->e_sendsig)(ps->ps_sigact[signum], signum,
-		    p->p_sigmask, trapno, code, sigval);
+		    p->p_sigmask, &si);
 		atomic_setbits_int(&p->p_sigmask, ps->ps_catchmask[signum]);
 		if ((ps->ps_sigreset & mask) != 0) {
 			ps->ps_sigcatch &= ~mask;
@@ -1328,7 +1327,6 @@ void
 proc_stop(struct proc *p, int sw)
 {
 	struct process *pr = p->p_p;
-	extern void *softclock_si;
 
 #ifdef MULTIPROCESSOR
 	SCHED_ASSERT_LOCKED();
@@ -1344,7 +1342,7 @@ proc_stop(struct proc *p, int sw)
 		 * We need this soft interrupt to be handled fast.
 		 * Extra calls to softclock don't hurt.
 		 */
-                softintr_schedule(softclock_si);
+		softclock_schedule();
 	}
 	if (sw)
 		mi_switch();
@@ -1382,10 +1380,9 @@ postsig(int signum)
 	struct process *pr = p->p_p;
 	struct sigacts *ps = pr->ps_sigacts;
 	sig_t action;
-	u_long trapno;
+	siginfo_t si;
 	int mask, returnmask;
-	union sigval sigval;
-	int s, code;
+	int s;
 
 #ifdef DIAGNOSTIC
 	if (signum == 0)
@@ -1397,25 +1394,21 @@ postsig(int signum)
 	mask = sigmask(signum);
 	atomic_clearbits_int(&p->p_siglist, mask);
 	action = ps->ps_sigact[signum];
-	sigval.sival_ptr = 0;
 
 	if (p->p_sisig != signum) {
-		trapno = 0;
-		code = SI_USER;
+		union sigval sigval;
+
 		sigval.sival_ptr = 0;
-	} else {
-		trapno = p->p_sitrapno;
-		code = p->p_sicode;
-		sigval = p->p_sigval;
-	}
+		initsiginfo(&si, signum, 0, SI_USER, sigval);
+		timer_siginfo(pr, &si);
+	} else
+		initsiginfo(&si, signum, p->p_sitrapno, p->p_sicode,
+		    p->p_sigval);
 
 #ifdef KTRACE
 	if (KTRPOINT(p, KTR_PSIG)) {
-		siginfo_t si;
-		
-		initsiginfo(&si, signum, trapno, code, sigval);
 		ktrpsig(p, signum, action, p->p_flag & P_SIGSUSPEND ?
-		    p->p_oldmask : p->p_sigmask, code, &si);
+		    p->p_oldmask : p->p_sigmask, si.si_code, &si);
 	}
 #endif
 	if (action == SIG_DFL) {
@@ -1469,8 +1462,7 @@ postsig(int signum)
 			p->p_sigval.sival_ptr = NULL;
 		}
 
-		(*pr->ps_emul->e_sendsig)(action, signum, returnmask, trapno,
-		    code, sigval);
+		(*pr->ps_emul->e_sendsig)(action, signum, returnmask, &si);
 	}
 
 	KERNEL_UNLOCK();
@@ -1894,6 +1886,9 @@ userret(struct proc *p)
 	}
 
 	p->p_cpu->ci_schedstate.spc_curpriority = p->p_priority = p->p_usrpri;
+
+	cpustate_switch(p->p_p->ps_nice > NZERO ? CP_NICE : CP_USER);
+	dynticks_update(p);
 }
 
 int
@@ -156,6 +156,39 @@ tsleep(const volatile void *ident, int priority, const char *wmesg, int timo)
 	return (error);
 }
 
+/*
+ * Same as tsleep, but sleeps until the deadline, in nanoseconds of
+ * uptime, rather than for a number of ticks.  The wakeup comes from
+ * the cpu's event timer when it has one, up to the process' timer
+ * slack late, instead of at the next tick.
+ */
+int
+tsleep_until(const volatile void *ident, int priority, const char *wmesg,
+    uint64_t deadline)
+{
+	struct sleep_state sls;
+	int error, error1;
+
+	KASSERT((priority & ~(PRIMASK | PCATCH)) == 0);
+
+	if (cold || panicstr)
+		return (tsleep(ident, priority, wmesg, 1));
+
+	sleep_setup(&sls, ident, priority, wmesg);
+	sleep_setup_deadline(&sls, deadline);
+	sleep_setup_signal(&sls, priority);
+
+	sleep_finish(&sls, 1);
+	error1 = sleep_finish_timeout(&sls);
+	error = sleep_finish_signal(&sls);
+
+	/* Signal errors are higher priority than timeouts. */
+	if (error == 0 && error1 != 0)
+		error = error1;
+
+	return (error);
+}
+
 /*
  * Same as tsleep, but if we have a mutex provided, then once we've
  * entered the sleep queue we drop the mutex. After sleeping we re-lock.
@@ -290,6 +323,15 @@ sleep_setup_timeout(struct sleep_state *sls, int timo)
 		timeout_add(&curproc->p_sleep_to, timo);
 }
 
+void
+sleep_setup_deadline(struct sleep_state *sls, uint64_t deadline)
+{
+	struct proc *p = curproc;
+
+	timeout_at_nsec_slack(&p->p_sleep_to, deadline,
+	    p->p_p->ps_timerslack);
+}
+
 int
 sleep_finish_timeout(struct sleep_state *sls)
 {
@@ -124,6 +124,8 @@ extern void nmbclust_update(void);
 int sysctl_diskinit(int, struct proc *);
 int sysctl_proc_args(int *, u_int, void *, size_t *, struct proc *);
 int sysctl_proc_cwd(int *, u_int, void *, size_t *, struct proc *);
+int sysctl_proc_timerslack(int *, u_int, void *, size_t, void *, size_t *,
+    struct proc *);
 int sysctl_proc_nobroadcastkill(int *, u_int, void *, size_t, void *, size_t *,
 	struct proc *);
 int sysctl_proc_vmmap(int *, u_int, void *, size_t *, struct proc *);
@@ -292,6 +294,7 @@ kern_sysctl(int *name, u_int namelen, void *oldp, size_t *oldlenp, void *newp,
 		case KERN_PROC_ARGS:
 		case KERN_PROC_CWD:
 		case KERN_PROC_NOBROADCASTKILL:
+		case KERN_PROC_TIMERSLACK:
 		case KERN_PROC_VMMAP:
 		case KERN_SYSVIPC_INFO:
 		case KERN_SEMINFO:
@@ -385,6 +388,9 @@ kern_sysctl(int *name, u_int namelen, void *oldp, size_t *oldlenp, void *newp,
 	case KERN_PROC_VMMAP:
 		return (sysctl_proc_vmmap(name + 1, namelen - 1, oldp, oldlenp,
 		     p));
+	case KERN_PROC_TIMERSLACK:
+		return (sysctl_proc_timerslack(name + 1, namelen - 1,
+		     newp, newlen, oldp, oldlenp, p));
 	case KERN_FILE:
 		return (sysctl_file(name + 1, namelen - 1, oldp, oldlenp, p));
 #endif
@@ -488,14 +494,16 @@ kern_sysctl(int *name, u_int namelen, void *oldp, size_t *oldlenp, void *newp,
 	{
 		CPU_INFO_ITERATOR cii;
 		struct cpu_info *ci;
+		u_int64_t cp_time2[CPUSTATES];
 		long cp_time[CPUSTATES];
 		int i;
 
 		memset(cp_time, 0, sizeof(cp_time));
 
 		CPU_INFO_FOREACH(cii, ci) {
+			cpustate_cp_time(ci, cp_time2);
 			for (i = 0; i < CPUSTATES; i++)
-				cp_time[i] += ci->ci_schedstate.spc_cp_time[i];
+				cp_time[i] += cp_time2[i];
 		}
 
 		for (i = 0; i < CPUSTATES; i++)
@@ -623,6 +631,8 @@ kern_sysctl(int *name, u_int namelen, void *oldp, size_t *oldlenp, void *newp,
 		return sysctl_int(oldp, oldlenp, newp, newlen, &global_ptrace);
 	}
 #endif
+	case KERN_DYNTICKS:
+		return (sysctl_dynticks(oldp, oldlenp, newp, newlen));
 	default:
 		return (EOPNOTSUPP);
 	}
@@ -1947,6 +1957,43 @@ sysctl_proc_nobroadcastkill(int *name, u_int namelen, void *newp, size_t newlen,
 	return (error);
 }
 
+int
+sysctl_proc_timerslack(int *name, u_int namelen, void *newp, size_t newlen,
+    void *oldp, size_t *oldlenp, struct proc *cp)
+{
+	struct process *findpr;
+	pid_t pid;
+	int error, slack;
+
+	if (namelen > 1)
+		return (ENOTDIR);
+	if (namelen < 1)
+		return (EINVAL);
+
+	pid = name[0];
+	if ((findpr = prfind(pid)) == NULL)
+		return (ESRCH);
+
+	/* Either system process or exiting/zombie */
+	if (findpr->ps_flags & (PS_SYSTEM | PS_EXITING))
+		return (EINVAL);
+
+	/* Only owner or root can change the timer slack */
+	if (newp != 0 && findpr->ps_ucred->cr_uid != cp->p_ucred->cr_uid &&
+	    (error = suser(cp, 0)) != 0)
+		return (error);
+
+	slack = findpr->ps_timerslack;
+	error = sysctl_int(oldp, oldlenp, newp, newlen, &slack);
+	if (error == 0 && newp) {
+		if (slack < 0 || slack > TIMERSLACK_MAX)
+			return (EINVAL);
+		findpr->ps_timerslack = slack;
+	}
+
+	return (error);
+}
+
 /* Arbitrary but reasonable limit for one iteration. */
 #define	VMMAP_MAXLEN	MAXPHYS
 
@@ -2375,6 +2422,7 @@ sysctl_cptime2(int *name, u_int namelen, void *oldp, size_t *oldlenp,
 {
 	CPU_INFO_ITERATOR cii;
 	struct cpu_info *ci;
+	u_int64_t cp_time[CPUSTATES];
 	int found = 0;
 
 	if (namelen != 1)
@@ -2389,7 +2437,7 @@ sysctl_cptime2(int *name, u_int namelen, void *oldp, size_t *oldlenp,
 	if (!found)
 		return (ENOENT);
 
-	return (sysctl_rdstruct(oldp, oldlenp, newp,
-	    &ci->ci_schedstate.spc_cp_time,
-	    sizeof(ci->ci_schedstate.spc_cp_time)));
+	cpustate_cp_time(ci, cp_time);
+	return (sysctl_rdstruct(oldp, oldlenp, newp, &cp_time,
+	    sizeof(cp_time)));
 }
@@ -29,6 +29,8 @@
 #include <sys/systm.h>
 #include <sys/timetc.h>
 #include <sys/malloc.h>
+#include <sys/atomic.h>
+#include <sys/mutex.h>
 #include <dev/rndvar.h>
 
 /*
@@ -110,7 +112,16 @@ struct bintime naptime;
 static struct bintime boottimebin;
 static int timestepwarnings;
 
+struct timekeep *timekeep;	/* see exec_timekeep_map() */
+
+/*
+ * Serializes tc_windup(), which any cpu keeping the time may run, with
+ * the clock being stepped, and covers the timekeep page too.
+ */
+struct mutex windup_mtx = MUTEX_INITIALIZER(IPL_HIGH);
+
 void tc_windup(void);
+void tc_publish_timekeep(void);
 
 /*
  * Return the difference between the timehands' counter value now and what
@@ -164,6 +175,18 @@ microuptime(struct timeval *tvp)
 	bintime2timeval(&bt, tvp);
 }
 
+/*
+ * Nanoseconds of uptime, the time base used for clock event deadlines.
+ */
+uint64_t
+nsecuptime(void)
+{
+	struct bintime bt;
+
+	binuptime(&bt);
+	return (bintime2nsec(&bt));
+}
+
 void
 bintime(struct bintime *bt)
 {
@@ -283,6 +306,38 @@ tc_init(struct timecounter *tc)
 	timecounter = tc;
 }
 
+/*
+ * Change the quality of a timecounter, e.g. once it turns out to be
+ * unreliable, and pick the best one again if it was in use.
+ */
+void
+tc_reset_quality(struct timecounter *tc, int quality)
+{
+	struct timecounter *best = &dummy_timecounter, *tmp;
+
+	tc->tc_quality = quality;
+	if (timecounter != tc)
+		return;
+
+	for (tmp = timecounters; tmp != NULL; tmp = tmp->tc_next) {
+		if (tmp->tc_quality < 0)
+			continue;
+		if (tmp->tc_quality < best->tc_quality)
+			continue;
+		if (tmp->tc_quality == best->tc_quality &&
+		    tmp->tc_frequency < best->tc_frequency)
+			continue;
+		best = tmp;
+	}
+	if (best != tc) {
+		(void)best->tc_get_timecount(best);
+		add_timer_randomness(best->tc_get_timecount(best));
+		printf("timecounter: switching from %s to %s\n",
+		    tc->tc_name, best->tc_name);
+		timecounter = best;
+	}
+}
+
 /* Report the frequency of the current timecounter. */
 u_int64_t
 tc_getfrequency(void)
@@ -294,7 +349,6 @@ tc_getfrequency(void)
 /*
  * Step our concept of UTC, aka the realtime clock.
  * This is done by modifying our estimate of when we booted.
- * XXX: not locked.
  */
 void
 tc_setrealtimeclock(struct timespec *ts)
@@ -302,16 +356,19 @@ tc_setrealtimeclock(struct timespec *ts)
 	struct timespec ts2;
 	struct bintime bt, bt2;
 
+	mtx_enter(&windup_mtx);
 	binuptime(&bt2);
 	timespec2bintime(ts, &bt);
 	bintime_sub(&bt, &bt2);
 	bintime_add(&bt2, &boottimebin);
 	boottimebin = bt;
 	bintime2timespec(&bt, &boottime);
-	add_timer_randomness(ts->tv_sec);
 
 	/* XXX fiddle all the little crinkly bits around the fiords... */
 	tc_windup();
+	mtx_leave(&windup_mtx);
+
+	add_timer_randomness(ts->tv_sec);
 	if (timestepwarnings) {
 		bintime2timespec(&bt2, &ts2);
 		log(LOG_INFO, "Time stepped from %lld.%09ld to %lld.%09ld\n",
@@ -323,7 +380,6 @@ tc_setrealtimeclock(struct timespec *ts)
 /*
  * Step the monotonic and realtime clocks, triggering any timeouts that
  * should have occurred across the interval.
- * XXX: not locked.
  */
 void
 tc_setclock(struct timespec *ts)
@@ -346,17 +402,21 @@ tc_setclock(struct timespec *ts)
 	add_timer_randomness(ts->tv_sec);
 
 	timespec2bintime(ts, &bt);
+	mtx_enter(&windup_mtx);
 	bintime_sub(&bt, &boottimebin);
 	bt2 = timehands->th_offset;
 	timehands->th_offset = bt;
+#ifndef SMALL_KERNEL
+	bintime_sub(&bt, &bt2);
+	bintime_add(&naptime, &bt);
+#endif
 
 	/* XXX fiddle all the little crinkly bits around the fiords... */
 	tc_windup();
+	mtx_leave(&windup_mtx);
 
 #ifndef SMALL_KERNEL
 	/* convert the bintime to ticks */
-	bintime_sub(&bt, &bt2);
-	bintime_add(&naptime, &bt);
 	adj_ticks = (long long)hz * bt.sec +
 	    (((uint64_t)1000000 * (uint32_t)(bt.frac >> 32)) >> 32) / tick;
 	if (adj_ticks > 0) {
@@ -371,6 +431,7 @@ tc_setclock(struct timespec *ts)
  * Initialize the next struct timehands in the ring and make
  * it the active timehands.  Along the way we might switch to a different
  * timecounter and/or do seconds processing in NTP.  Slightly magic.
+ * Called with windup_mtx held.
  */
 void
 tc_windup(void)
@@ -384,6 +445,8 @@ tc_windup(void)
 	time_t t;
 #endif
 
+	MUTEX_ASSERT_LOCKED(&windup_mtx);
+
 	/*
 	 * Make the next timehands a copy of the current one, but do not
 	 * overwrite the generation or next pointer.  While we update
@@ -490,6 +553,48 @@ tc_windup(void)
 	time_second = th->th_microtime.tv_sec;
 	time_uptime = th->th_offset.sec;
 	timehands = th;
+
+	tc_publish_timekeep();
+}
+
+/*
+ * Publish the current timehands to userland.  Like the timehands
+ * themselves, the page has generation 0 while we update it.  It is
+ * also updated without a tc_windup(), so it counts generations of its
+ * own.
+ */
+void
+tc_publish_timekeep(void)
+{
+	static u_int tkgen;
+	struct timehands *th = timehands;
+	struct timekeep *tk = timekeep;
+
+	MUTEX_ASSERT_LOCKED(&windup_mtx);
+	if (tk == NULL)
+		return;
+
+	tk->tk_generation = 0;
+	membar_producer();
+	tk->tk_scale = th->th_scale;
+	tk->tk_offset_count = th->th_offset_count;
+	tk->tk_counter_mask = th->th_counter->tc_counter_mask;
+	tk->tk_offset = th->th_offset;
+	tk->tk_naptime = naptime;
+	tk->tk_boottime = boottimebin;
+	tk->tk_user = th->th_counter->tc_user;
+	membar_producer();
+	if (++tkgen == 0)
+		tkgen = 1;
+	tk->tk_generation = tkgen;
+}
+
+void
+tc_update_timekeep(void)
+{
+	mtx_enter(&windup_mtx);
+	tc_publish_timekeep();
+	mtx_leave(&windup_mtx);
 }
 
 /* Report or change the active timecounter hardware. */
@@ -554,14 +659,31 @@ sysctl_tc_choice(void *oldp, size_t *oldlenp, void *newp, size_t newlen)
 static int tc_tick;
 
 void
-tc_ticktock(void)
+tc_ticktock(int n)
 {
 	static int count;
 
-	if (++count < tc_tick)
+	/* After all cpus were tickless, n can be large. */
+	count += n;
+	if (count < tc_tick)
 		return;
 	count = 0;
+	mtx_enter(&windup_mtx);
 	tc_windup();
+	mtx_leave(&windup_mtx);
+}
+
+/*
+ * Return how long tc_windup() may be put off, in nanoseconds, before
+ * the timecounter wraps around.  Keep half of its period as a margin.
+ */
+u_int64_t
+tc_wrap_nsec(void)
+{
+	struct timecounter *tc = timehands->th_counter;
+
+	return ((u_int64_t)(tc->tc_counter_mask / 2) * 1000000000 /
+	    tc->tc_frequency);
 }
 
 void
@@ -591,6 +713,15 @@ inittimecounter(void)
 	/* warm up new timecounter (again) and get rolling. */
 	(void)timecounter->tc_get_timecount(timecounter);
 	(void)timecounter->tc_get_timecount(timecounter);
+
+	/*
+	 * Switch to it right away rather than at the first tick: clock
+	 * event deadlines are kept in uptime, and the dummy timecounter
+	 * only moves when it is read.
+	 */
+	mtx_enter(&windup_mtx);
+	tc_windup();
+	mtx_leave(&windup_mtx);
 }
 
 /*
@@ -42,6 +42,10 @@
 #include <sys/signalvar.h>
 #include <sys/pledge.h>
 #include <sys/timetc.h>
+#include <sys/pool.h>
+#include <sys/file.h>
+#include <sys/filedesc.h>
+#include <sys/event.h>
 
 #include <sys/mount.h>
 #include <sys/syscallargs.h>
@@ -204,6 +208,28 @@ sys_clock_settime(struct proc *p, void *v, register_t *retval)
 	return (0);
 }
 
+/*
+ * The resolution of the clocks, in nanoseconds: how finely the
+ * timecounter reads them and, for clocks that timers and sleeps run
+ * against, how finely the event timer can fire if that's coarser.
+ * Without an event timer those run off the tick.
+ */
+uint64_t
+clock_resolution(int timed)
+{
+	uint64_t freq, res, evres;
+
+	freq = tc_getfrequency();
+	res = freq ? (1000000000 + freq - 1) / freq : 1;
+	if (timed) {
+		evres = cpu_clockev_res();
+		if (evres == 0)
+			evres = 1000000000 / hz;
+		res = MAX(res, evres);
+	}
+	return (res);
+}
+
 int
 sys_clock_getres(struct proc *p, void *v, register_t *retval)
 {
@@ -222,10 +248,13 @@ sys_clock_getres(struct proc *p, void *v, register_t *retval)
 	case CLOCK_REALTIME:
 	case CLOCK_MONOTONIC:
 	case CLOCK_UPTIME:
+		ts.tv_sec = 0;
+		ts.tv_nsec = clock_resolution(1);
+		break;
 	case CLOCK_PROCESS_CPUTIME_ID:
 	case CLOCK_THREAD_CPUTIME_ID:
 		ts.tv_sec = 0;
-		ts.tv_nsec = 1000000000 / hz;
+		ts.tv_nsec = clock_resolution(0);
 		break;
 	default:
 		/* check for clock from pthread_getcpuclockid() */
@@ -234,7 +263,7 @@ sys_clock_getres(struct proc *p, void *v, register_t *retval)
 			if (q == NULL || q->p_p != p->p_p)
 				return (ESRCH);
 			ts.tv_sec = 0;
-			ts.tv_nsec = 1000000000 / hz;
+			ts.tv_nsec = clock_resolution(0);
 		} else
 			return (EINVAL);
 	}
@@ -265,6 +294,7 @@ sys_nanosleep(struct proc *p, void *v, register_t *retval)
 	struct timespec sts, ets;
 	struct timespec *rmtp;
 	struct timeval tv;
+	uint64_t deadline;
 	int error, error1;
 
 	rmtp = SCARG(uap, rmtp);
@@ -283,18 +313,17 @@ sys_nanosleep(struct proc *p, void *v, register_t *retval)
 	if (itimerfix(&tv))
 		return (EINVAL);
 
-	if (rmtp)
-		getnanouptime(&sts);
+	nanouptime(&sts);
+	deadline = TIMESPEC_TO_NSEC(&sts) + TIMESPEC_TO_NSEC(&rqt);
 
-	error = tsleep(&nanowait, PWAIT | PCATCH, "nanosleep",
-	    MAX(1, tvtohz(&tv)));
+	error = tsleep_until(&nanowait, PWAIT | PCATCH, "nanosleep", deadline);
 	if (error == ERESTART)
 		error = EINTR;
 	if (error == EWOULDBLOCK)
 		error = 0;
 
 	if (rmtp) {
-		getnanouptime(&ets);
+		nanouptime(&ets);
 
 		memset(&rmt, 0, sizeof(rmt));
 		timespecsub(&ets, &sts, &sts);
@@ -458,7 +487,7 @@ sys_adjtime(struct proc *p, void *v, register_t *retval)
 }
 
 
-struct mutex itimer_mtx = MUTEX_INITIALIZER(IPL_CLOCK);
+struct mutex itimer_mtx = MUTEX_INITIALIZER(IPL_HIGH);
 
 /*
  * Get value of an interval timer.  The process virtual and
@@ -504,7 +533,7 @@ sys_getitimer(struct proc *p, void *v, register_t *retval)
 	if (which == ITIMER_REAL) {
 		struct timeval now;
 
-		getmicrouptime(&now);
+		microuptime(&now);
 		/*
 		 * Convert from absolute to relative time in .it_value
 		 * part of real time timer.  If time for real time timer
@@ -537,7 +566,6 @@ sys_setitimer(struct proc *p, void *v, register_t *retval)
 	struct itimerval *oitv;
 	struct process *pr = p->p_p;
 	int error;
-	int timo;
 	int which;
 
 	which = SCARG(uap, which);
@@ -562,14 +590,20 @@ sys_setitimer(struct proc *p, void *v, register_t *retval)
 	if (which == ITIMER_REAL) {
 		struct timeval ctv;
 
+		/*
+		 * Keep it_value as an absolute time of uptime and fire
+		 * at exactly that from the event timer.  Set the timer
+		 * before arming, the timeout may run right away.
+		 */
 		timeout_del(&pr->ps_realit_to);
-		getmicrouptime(&ctv);
-		if (timerisset(&aitv.it_value)) {
-			timo = tvtohz(&aitv.it_value);
-			timeout_add(&pr->ps_realit_to, timo);
+		microuptime(&ctv);
+		if (timerisset(&aitv.it_value))
 			timeradd(&aitv.it_value, &ctv, &aitv.it_value);
-		}
 		pr->ps_timer[ITIMER_REAL] = aitv;
+		pr->ps_realit_overrun = 0;
+		if (timerisset(&aitv.it_value))
+			timeout_at_nsec(&pr->ps_realit_to,
+			    TIMEVAL_TO_NSEC(&aitv.it_value));
 	} else {
 		itimerround(&aitv.it_interval);
 		mtx_enter(&itimer_mtx);
@@ -580,42 +614,508 @@ sys_setitimer(struct proc *p, void *v, register_t *retval)
 	return (0);
 }
 
+/*
+ * Add to an overrun count, saturating like timer_getoverrun(2) does.
+ */
+static void
+overrunadd(int *cnt, uint64_t n)
+{
+	if (n > INT_MAX - *cnt)
+		*cnt = INT_MAX;
+	else
+		*cnt += n;
+}
+
+/*
+ * Is sig pending in any of the process's threads?
+ */
+static int
+process_sigpending(struct process *pr, int sig)
+{
+	struct proc *q;
+
+	TAILQ_FOREACH(q, &pr->ps_threads, p_thr_link) {
+		if (q->p_siglist & sigmask(sig))
+			return (1);
+	}
+	return (0);
+}
+
 /*
  * Real interval timer expired:
  * send process whose timer expired an alarm signal.
  * If time is not set up to reload, then just return.
- * Else compute next time timer should go off which is > current time.
- * This is where delay in processing this timeout causes multiple
- * SIGALRM calls to be compressed into one.
+ * Else compute the next time the timer should go off: a whole number
+ * of intervals after the last one, so that the period doesn't drift
+ * however late this runs.  Expirations that this was too late for,
+ * or that found the last SIGALRM still pending, can't be signalled
+ * on their own; they are counted in ps_realit_overrun instead, which
+ * the SIGALRM carries as si_overrun, see timer_siginfo().
  */
 void
 realitexpire(void *arg)
 {
 	struct process *pr = arg;
 	struct itimerval *tp = &pr->ps_timer[ITIMER_REAL];
+	uint64_t now, next, interval, n;
 
+	if (pr->ps_realit_sigpending && process_sigpending(pr, SIGALRM))
+		overrunadd(&pr->ps_realit_overrun, 1);
+	else {
+		pr->ps_realit_overrun = 0;
+		pr->ps_realit_sigpending = 1;
+	}
 	prsignal(pr, SIGALRM);
+
 	if (!timerisset(&tp->it_interval)) {
 		timerclear(&tp->it_value);
 		return;
 	}
-	for (;;) {
-		struct timeval ctv, ntv;
-		int timo;
-
-		timeradd(&tp->it_value, &tp->it_interval, &tp->it_value);
-		getmicrouptime(&ctv);
-		if (timercmp(&tp->it_value, &ctv, >)) {
-			ntv = tp->it_value;
-			timersub(&ntv, &ctv, &ntv);
-			timo = tvtohz(&ntv) - 1;
-			if (timo <= 0)
-				timo = 1;
-			if ((pr->ps_flags & PS_EXITING) == 0)
-				timeout_add(&pr->ps_realit_to, timo);
+
+	/*
+	 * Intervals shorter than TIMER_MINPERIOD end several at a time;
+	 * all but the first are overruns.
+	 */
+	interval = TIMEVAL_TO_NSEC(&tp->it_interval);
+	next = TIMEVAL_TO_NSEC(&tp->it_value) + interval;
+	now = nsecuptime();
+	if (next <= now) {
+		n = (now - next) / interval + 1;
+		overrunadd(&pr->ps_realit_overrun, n);
+		next += n * interval;
+	}
+	NSEC_TO_TIMEVAL(next, &tp->it_value);
+	if ((pr->ps_flags & PS_EXITING) == 0)
+		timeout_at_nsec(&pr->ps_realit_to,
+		    MAX(next, now + TIMER_MINPERIOD));
+}
+
+/*
+ * POSIX per-process timers, see timer_create(2).
+ *
+ * They run off a timeout at a deadline in nanoseconds of uptime, like
+ * the real interval timer; an absolute CLOCK_REALTIME time is turned
+ * into uptime once, when the timer is set.  A periodic timer rearms a
+ * whole number of intervals after the deadline that passed, and the
+ * expirations that can't be notified on their own are overruns.
+ *
+ * Expiry is notified with a signal carrying SI_TIMER and sigev_value,
+ * or by the EVFILT_PTIMER knotes attached to the timer: SIGEV_KEVENT
+ * attaches one to sigev_notify_kqueue when the timer is created.
+ */
+struct ptimer {
+	LIST_ENTRY(ptimer) pt_list;	/* on ps_ptimers */
+	struct process	*pt_process;	/* owner */
+	struct timeout	pt_to;		/* fires at pt_next */
+	struct klist	pt_klist;	/* EVFILT_PTIMER knotes */
+	struct sigevent	pt_ev;		/* how to notify */
+	clockid_t	pt_clock;	/* CLOCK_REALTIME or CLOCK_MONOTONIC */
+	timer_t		pt_id;		/* id handed to userland */
+	uint64_t	pt_next;	/* deadline, 0 if disarmed */
+	uint64_t	pt_interval;	/* nsec period, 0 if it fires once */
+	int		pt_sigpending;	/* signal sent and not yet taken */
+	int		pt_overruns;	/* overruns while it is pending */
+	int		pt_overrun;	/* overruns of the last one taken */
+};
+
+#define	PTIMER_MAX	32	/* per process, as bits in ps_ptimer_ids */
+
+struct pool ptimer_pool;
+
+void	ptimer_expire(void *);
+int	filt_ptimerattach(struct knote *);
+void	filt_ptimerdetach(struct knote *);
+int	filt_ptimer(struct knote *, long);
+
+struct filterops ptimer_filtops =
+	{ 0, filt_ptimerattach, filt_ptimerdetach, filt_ptimer };
+
+void
+ptimer_init(void)
+{
+	pool_init(&ptimer_pool, sizeof(struct ptimer), 0, 0, PR_WAITOK,
+	    "ptimerpl", NULL);
+}
+
+static struct ptimer *
+ptimer_lookup(struct process *pr, timer_t id)
+{
+	struct ptimer *pt;
+
+	LIST_FOREACH(pt, &pr->ps_ptimers, pt_list) {
+		if (pt->pt_id == id)
+			return (pt);
+	}
+	return (NULL);
+}
+
+static void
+ptimer_delete(struct proc *p, struct ptimer *pt)
+{
+	struct process *pr = pt->pt_process;
+
+	timeout_del(&pt->pt_to);
+	knote_remove(p, &pt->pt_klist);
+	LIST_REMOVE(pt, pt_list);
+	pr->ps_ptimer_ids &= ~(1U << pt->pt_id);
+	pool_put(&ptimer_pool, pt);
+}
+
+/*
+ * Timers don't survive exec or exit.
+ */
+void
+ptimer_deleteall(struct proc *p)
+{
+	struct process *pr = p->p_p;
+	struct ptimer *pt;
+
+	while ((pt = LIST_FIRST(&pr->ps_ptimers)) != NULL)
+		ptimer_delete(p, pt);
+}
+
+/*
+ * Time left until the timer expires and its period.  An armed timer
+ * that is running late still has some time left.
+ */
+static void
+ptimer_get(struct ptimer *pt, struct itimerspec *its)
+{
+	uint64_t now;
+
+	memset(its, 0, sizeof(*its));
+	NSEC_TO_TIMESPEC(pt->pt_interval, &its->it_interval);
+	if (pt->pt_next != 0) {
+		now = nsecuptime();
+		NSEC_TO_TIMESPEC(pt->pt_next > now ? pt->pt_next - now : 1,
+		    &its->it_value);
+	}
+}
+
+void
+ptimer_expire(void *arg)
+{
+	struct ptimer *pt = arg;
+	struct process *pr = pt->pt_process;
+	uint64_t now, n = 0;
+
+	if (pt->pt_interval != 0) {
+		/*
+		 * Intervals shorter than TIMER_MINPERIOD end several at
+		 * a time; all but the first are overruns.
+		 */
+		pt->pt_next += pt->pt_interval;
+		now = nsecuptime();
+		if (pt->pt_next <= now) {
+			n = (now - pt->pt_next) / pt->pt_interval + 1;
+			pt->pt_next += n * pt->pt_interval;
+		}
+		if ((pr->ps_flags & PS_EXITING) == 0)
+			timeout_at_nsec(&pt->pt_to,
+			    MAX(pt->pt_next, now + TIMER_MINPERIOD));
+	} else
+		pt->pt_next = 0;
+
+	KNOTE(&pt->pt_klist, (long)MIN(n + 1, INT_MAX));
+
+	if (pt->pt_ev.sigev_notify != SIGEV_SIGNAL) {
+		pt->pt_overrun = 0;
+		overrunadd(&pt->pt_overrun, n);
+		return;
+	}
+
+	/*
+	 * Signals don't queue: while the last one is pending, count
+	 * this expiration with the overruns it will report.  If it is
+	 * gone without postsig() seeing it, e.g. taken by sigwait(2),
+	 * its overruns become the ones reported.
+	 */
+	if (pt->pt_sigpending) {
+		if (process_sigpending(pr, pt->pt_ev.sigev_signo)) {
+			overrunadd(&pt->pt_overruns, n + 1);
 			return;
 		}
+		pt->pt_overrun = pt->pt_overruns;
+	}
+	pt->pt_sigpending = 1;
+	pt->pt_overruns = 0;
+	overrunadd(&pt->pt_overruns, n);
+	prsignal(pr, pt->pt_ev.sigev_signo);
+}
+
+/*
+ * Called by postsig() for a signal that didn't come with siginfo of
+ * its own: if a timer sent it, turn si into SI_TIMER with the number
+ * of expirations merged into it as the overrun.  A POSIX timer's
+ * signal carries its id and sigev_value, and its overruns become the
+ * ones timer_getoverrun(2) reports.  Otherwise it may be the real
+ * interval timer's SIGALRM, which has no id.
+ */
+void
+timer_siginfo(struct process *pr, siginfo_t *si)
+{
+	struct ptimer *pt;
+
+	LIST_FOREACH(pt, &pr->ps_ptimers, pt_list) {
+		if (pt->pt_sigpending &&
+		    pt->pt_ev.sigev_notify == SIGEV_SIGNAL &&
+		    pt->pt_ev.sigev_signo == si->si_signo) {
+			pt->pt_sigpending = 0;
+			pt->pt_overrun = pt->pt_overruns;
+			pt->pt_overruns = 0;
+			si->si_code = SI_TIMER;
+			si->si_timerid = pt->pt_id;
+			si->si_overrun = pt->pt_overrun;
+			si->si_value = pt->pt_ev.sigev_value;
+			return;
+		}
+	}
+
+	if (si->si_signo == SIGALRM && pr->ps_realit_sigpending) {
+		pr->ps_realit_sigpending = 0;
+		si->si_code = SI_TIMER;
+		si->si_timerid = -1;
+		si->si_overrun = pr->ps_realit_overrun;
+		pr->ps_realit_overrun = 0;
+	}
+}
+
+/*
+ * EVFILT_PTIMER: ident is one of the process's timers, data the number
+ * of times it expired since the event was last read.
+ */
+int
+filt_ptimerattach(struct knote *kn)
+{
+	struct ptimer *pt;
+
+	if (kn->kn_id >= PTIMER_MAX ||
+	    (pt = ptimer_lookup(curproc->p_p, kn->kn_id)) == NULL)
+		return (EINVAL);
+
+	kn->kn_hook = pt;
+	kn->kn_flags |= EV_CLEAR;		/* automatically set */
+	SLIST_INSERT_HEAD(&pt->pt_klist, kn, kn_selnext);
+
+	return (0);
+}
+
+void
+filt_ptimerdetach(struct knote *kn)
+{
+	struct ptimer *pt = kn->kn_hook;
+
+	SLIST_REMOVE(&pt->pt_klist, kn, knote, kn_selnext);
+}
+
+int
+filt_ptimer(struct knote *kn, long hint)
+{
+	kn->kn_data += hint;
+	return (kn->kn_data != 0);
+}
+
+int
+sys_timer_create(struct proc *p, void *v, register_t *retval)
+{
+	struct sys_timer_create_args /* {
+		syscallarg(clockid_t) clock_id;
+		syscallarg(const struct sigevent *) evp;
+		syscallarg(timer_t *) timerid;
+	} */ *uap = v;
+	struct process *pr = p->p_p;
+	struct sigevent ev;
+	struct kevent kev;
+	struct ptimer *pt;
+	struct file *fp = NULL;
+	timer_t id;
+	int error;
+
+	switch (SCARG(uap, clock_id)) {
+	case CLOCK_REALTIME:
+	case CLOCK_MONOTONIC:
+		break;
+	default:
+		return (EINVAL);
+	}
+
+	if (SCARG(uap, evp) != NULL) {
+		error = copyin(SCARG(uap, evp), &ev, sizeof(ev));
+		if (error)
+			return (error);
+	} else {
+		memset(&ev, 0, sizeof(ev));
+		ev.sigev_notify = SIGEV_SIGNAL;
+		ev.sigev_signo = SIGALRM;
+	}
+
+	/* SIGEV_THREAD is up to libc, which makes it a signal. */
+	switch (ev.sigev_notify) {
+	case SIGEV_NONE:
+		break;
+	case SIGEV_SIGNAL:
+		if (ev.sigev_signo <= 0 || ev.sigev_signo >= NSIG)
+			return (EINVAL);
+		break;
+	case SIGEV_KEVENT:
+		if ((fp = fd_getfile(p->p_fd, ev.sigev_notify_kqueue)) ==
+		    NULL || fp->f_type != DTYPE_KQUEUE)
+			return (EBADF);
+		FREF(fp);
+		break;
+	default:
+		return (EINVAL);
+	}
+
+	if (pr->ps_ptimer_ids == 0xffffffff) {
+		error = EAGAIN;
+		goto out;
+	}
+	pt = pool_get(&ptimer_pool, PR_WAITOK | PR_ZERO);
+	/* Another thread may have taken the last id while we slept. */
+	if (pr->ps_ptimer_ids == 0xffffffff) {
+		pool_put(&ptimer_pool, pt);
+		error = EAGAIN;
+		goto out;
+	}
+	id = ffs(~pr->ps_ptimer_ids) - 1;
+	KASSERT(id >= 0 && id < PTIMER_MAX);
+
+	pt->pt_process = pr;
+	timeout_set(&pt->pt_to, ptimer_expire, pt);
+	pt->pt_ev = ev;
+	if (SCARG(uap, evp) == NULL)
+		pt->pt_ev.sigev_value.sival_int = id;
+	pt->pt_clock = SCARG(uap, clock_id);
+	pt->pt_id = id;
+	pr->ps_ptimer_ids |= 1U << id;
+	LIST_INSERT_HEAD(&pr->ps_ptimers, pt, pt_list);
+
+	if (fp != NULL) {
+		EV_SET(&kev, id, EVFILT_PTIMER, EV_ADD, 0, 0,
+		    ev.sigev_value.sival_ptr);
+		error = kqueue_register(fp->f_data, &kev, p);
+		if (error) {
+			ptimer_delete(p, pt);
+			goto out;
+		}
 	}
+
+	error = copyout(&id, SCARG(uap, timerid), sizeof(id));
+	if (error)
+		ptimer_delete(p, pt);
+out:
+	if (fp != NULL)
+		FRELE(fp, p);
+	return (error);
+}
+
+int
+sys_timer_delete(struct proc *p, void *v, register_t *retval)
+{
+	struct sys_timer_delete_args /* {
+		syscallarg(timer_t) timerid;
+	} */ *uap = v;
+	struct ptimer *pt;
+
+	if ((pt = ptimer_lookup(p->p_p, SCARG(uap, timerid))) == NULL)
+		return (EINVAL);
+	ptimer_delete(p, pt);
+
+	return (0);
+}
+
+int
+sys_timer_settime(struct proc *p, void *v, register_t *retval)
+{
+	struct sys_timer_settime_args /* {
+		syscallarg(timer_t) timerid;
+		syscallarg(int) flags;
+		syscallarg(const struct itimerspec *) value;
+		syscallarg(struct itimerspec *) ovalue;
+	} */ *uap = v;
+	struct itimerspec its, oits;
+	struct timespec rt;
+	struct ptimer *pt;
+	uint64_t now, value;
+	int error;
+
+	error = copyin(SCARG(uap, value), &its, sizeof(its));
+	if (error)
+		return (error);
+	if (timespecfix(&its.it_interval))
+		return (EINVAL);
+	if (SCARG(uap, flags) & TIMER_ABSTIME) {
+		if (its.it_value.tv_sec < 0 || its.it_value.tv_nsec < 0 ||
+		    its.it_value.tv_nsec >= 1000000000)
+			return (EINVAL);
+	} else if (timespecfix(&its.it_value))
+		return (EINVAL);
+
+	/* Look it up after copyin, it may have been deleted meanwhile. */
+	if ((pt = ptimer_lookup(p->p_p, SCARG(uap, timerid))) == NULL)
+		return (EINVAL);
+
+	ptimer_get(pt, &oits);
+	timeout_del(&pt->pt_to);
+	pt->pt_next = 0;
+	pt->pt_interval = 0;
+	if (timespecisset(&its.it_value)) {
+		now = nsecuptime();
+		value = TIMESPEC_TO_NSEC(&its.it_value);
+		if ((SCARG(uap, flags) & TIMER_ABSTIME) == 0)
+			pt->pt_next = now + value;
+		else if (pt->pt_clock == CLOCK_REALTIME) {
+			/*
+			 * Convert the time of day to uptime once, as
+			 * EVFILT_TIMER does; a later step of the clock
+			 * doesn't move the deadline.
+			 */
+			nanotime(&rt);
+			pt->pt_next = now;
+			if (value > TIMESPEC_TO_NSEC(&rt))
+				pt->pt_next += value - TIMESPEC_TO_NSEC(&rt);
+		} else
+			pt->pt_next = value;
+		pt->pt_interval = TIMESPEC_TO_NSEC(&its.it_interval);
+		timeout_at_nsec(&pt->pt_to, pt->pt_next);
+	}
+
+	if (SCARG(uap, ovalue) != NULL)
+		return (copyout(&oits, SCARG(uap, ovalue), sizeof(oits)));
+	return (0);
+}
+
+int
+sys_timer_gettime(struct proc *p, void *v, register_t *retval)
+{
+	struct sys_timer_gettime_args /* {
+		syscallarg(timer_t) timerid;
+		syscallarg(struct itimerspec *) value;
+	} */ *uap = v;
+	struct itimerspec its;
+	struct ptimer *pt;
+
+	if ((pt = ptimer_lookup(p->p_p, SCARG(uap, timerid))) == NULL)
+		return (EINVAL);
+	ptimer_get(pt, &its);
+
+	return (copyout(&its, SCARG(uap, value), sizeof(its)));
+}
+
+int
+sys_timer_getoverrun(struct proc *p, void *v, register_t *retval)
+{
+	struct sys_timer_getoverrun_args /* {
+		syscallarg(timer_t) timerid;
+	} */ *uap = v;
+	struct ptimer *pt;
+
+	if ((pt = ptimer_lookup(p->p_p, SCARG(uap, timerid))) == NULL)
+		return (EINVAL);
+	*retval = pt->pt_overrun;
+
+	return (0);
 }
 
 /*
@@ -642,8 +1142,7 @@ itimerfix(struct timeval *tv)
 	    tv->tv_usec < 0 || tv->tv_usec >= 1000000)
 		return (EINVAL);
 
-	if (tv->tv_sec == 0 && tv->tv_usec != 0 && tv->tv_usec < tick)
-		tv->tv_usec = tick;
+	itimerround(tv);
 
 	return (0);
 }
@@ -655,8 +1154,55 @@ itimerfix(struct timeval *tv)
 void
 itimerround(struct timeval *tv)
 {
-	if (tv->tv_sec == 0 && tv->tv_usec != 0 && tv->tv_usec < tick)
-		tv->tv_usec = tick;
+	long res;
+
+	res = (clock_resolution(1) + 999) / 1000;
+	if (tv->tv_sec == 0 && tv->tv_usec != 0 && tv->tv_usec < res)
+		tv->tv_usec = res;
+}
+
+/*
+ * Charge nsec of a thread's run time to its process's virtual or
+ * profiling timer.  The part below a microsecond is carried over in
+ * the thread.  Returns 0 if the timer expired, like itimerdecr().
+ */
+int
+itimercharge(struct proc *p, int which, uint64_t nsec)
+{
+	struct itimerval *itp = &p->p_p->ps_timer[which];
+	uint64_t usec;
+	int chunk, expired = 0;
+
+	nsec += p->p_itcarry[which - ITIMER_VIRTUAL];
+	p->p_itcarry[which - ITIMER_VIRTUAL] = nsec % 1000;
+	for (usec = nsec / 1000; usec > 0; usec -= chunk) {
+		if (!timerisset(&itp->it_value))
+			break;
+		chunk = MIN(usec, 999999);
+		if (itimerdecr(itp, chunk) == 0)
+			expired = 1;
+	}
+
+	return (!expired);
+}
+
+/*
+ * Return the run time left until one of a thread's virtual or
+ * profiling timers expires, in nanoseconds, or 0 if it is not set.
+ */
+uint64_t
+itimerleft(struct proc *p, int which)
+{
+	struct itimerval *itp = &p->p_p->ps_timer[which];
+	uint64_t nsec;
+
+	mtx_enter(&itimer_mtx);
+	nsec = (uint64_t)itp->it_value.tv_sec * 1000000000ULL +
+	    itp->it_value.tv_usec * 1000ULL;
+	mtx_leave(&itimer_mtx);
+	if (nsec == 0)
+		return (0);
+	return (nsec - p->p_itcarry[which - ITIMER_VIRTUAL]);
 }
 
 /*
@@ -31,7 +31,11 @@
 #include <sys/timeout.h>
 #include <sys/mutex.h>
 #include <sys/kernel.h>
+#include <sys/malloc.h>
 #include <sys/queue.h>			/* _Q_INVALIDATE */
+#include <sys/sched.h>
+#include <sys/atomic.h>
+#include <sys/time.h>
 
 #ifdef DDB
 #include <machine/db_machdep.h>
@@ -39,37 +43,70 @@
 #include <ddb/db_sym.h>
 #include <ddb/db_output.h>
 #endif
-
 /*
  * Timeouts are kept in a hierarchical timing wheel. The to_time is the value
  * of the global variable "ticks" when the timeout should be called. There are
  * four levels with 256 buckets each. See 'Scheme 7' in
  * "Hashed and Hierarchical Timing Wheels: Efficient Data Structures for
  * Implementing a Timer Facility" by George Varghese and Tony Lauck.
+ *
+ * Every cpu has a wheel of its own.  Timeouts are added to the wheel of
+ * the cpu that adds them and run by that cpu's softclock.  The wheel has
+ * its own idea of "ticks", tw_ticks, which hardclock on the owning cpu
+ * advances up to the global value.
+ *
+ * Each level of a wheel has a bitmap of the buckets that are occupied,
+ * which lets timeout_next_expiry() find the next bucket to move without
+ * looking at the buckets, and lets a wheel skip over idle ticks.
+ *
+ * Deferrable timeouts have buckets of their own, after the BUCKETS
+ * regular ones.  They are moved along with the regular ones but are
+ * not considered by timeout_next_expiry(), so a tickless cpu runs them
+ * once something else wakes it up.
  */
 #define BUCKETS 1024
 #define WHEELSIZE 256
 #define WHEELMASK 255
 #define WHEELBITS 8
-
-struct circq timeout_wheel[BUCKETS];	/* Queues of timeouts */
-struct circq timeout_todo;		/* Worklist */
+#define WHEELCOUNT 4
+#define WHEELWORDS (WHEELSIZE / 32)
+
+struct timeout_wheel {
+	struct mutex	tw_mtx;
+	struct circq	tw_wheel[2 * BUCKETS];	/* Queues of timeouts */
+	struct circq	tw_todo;		/* Worklist */
+	struct circq	tw_nsec;		/* Deadline ordered, see below */
+	int		tw_ticks;		/* ticks the wheel is at */
+	int		tw_count;		/* timeouts on wheel and todo */
+	uint32_t	tw_bits[2 * WHEELCOUNT][WHEELWORDS]; /* occupied */
+	int		tw_next[2];		/* next bucket move at ... */
+	int		tw_nextbase;		/* ... these ticks, if ... */
+	int		tw_nextok;		/* ... this is set */
+	void		*tw_si;			/* softclock */
+};
+
+struct timeout_wheel timeout_wheel_primary;
 
 #define MASKWHEEL(wheel, time) (((time) >> ((wheel)*WHEELBITS)) & WHEELMASK)
 
 #define BUCKET(rel, abs)						\
-    (timeout_wheel[							\
-	((rel) <= (1 << (2*WHEELBITS)))					\
+	(((rel) <= (1 << (2*WHEELBITS)))				\
 	    ? ((rel) <= (1 << WHEELBITS))				\
 		? MASKWHEEL(0, (abs))					\
 		: MASKWHEEL(1, (abs)) + WHEELSIZE			\
 	    : ((rel) <= (1 << (3*WHEELBITS)))				\
 		? MASKWHEEL(2, (abs)) + 2*WHEELSIZE			\
-		: MASKWHEEL(3, (abs)) + 3*WHEELSIZE])
+		: MASKWHEEL(3, (abs)) + 3*WHEELSIZE)
+
+#define MOVEBUCKET(tw, wheel, time) do {				\
+	int __b = MASKWHEEL((wheel), (time)) + (wheel)*WHEELSIZE;	\
+	timeout_movebucket((tw), __b);					\
+	timeout_movebucket((tw), __b + BUCKETS);			\
+} while (0)
 
-#define MOVEBUCKET(wheel, time)						\
-    CIRCQ_APPEND(&timeout_todo,						\
-        &timeout_wheel[MASKWHEEL((wheel), (time)) + (wheel)*WHEELSIZE])
+#define BUCKETBIT(tw, b)						\
+    ((tw)->tw_bits[(b) / WHEELSIZE][((b) % WHEELSIZE) / 32])
+#define BUCKETMASK(b)	(1U << ((b) % 32))
 
 /*
  * The first thing in a struct timeout is its struct circq, so we
@@ -83,12 +120,26 @@ timeout_from_circq(struct circq *p)
 }
 
 /*
- * All wheels are locked with the same mutex.
+ * Each wheel is locked with its own mutex.
  *
  * We need locking since the timeouts are manipulated from hardclock that's
- * not behind the big lock.
+ * not behind the big lock, and from other cpus.  A timeout belongs to the
+ * wheel it was last added to, even after it ran, and to_wheel only changes
+ * with that wheel locked.  See timeout_lock().
  */
-struct mutex timeout_mutex = MUTEX_INITIALIZER(IPL_HIGH);
+
+void	timeout_wheel_init(struct timeout_wheel *);
+struct timeout_wheel *timeout_lock(struct timeout *);
+struct timeout_wheel *timeout_lock_cur(struct timeout *, int *);
+void	timeout_movebucket(struct timeout_wheel *, int);
+void	timeout_insert(struct timeout_wheel *, struct timeout *);
+void	timeout_remove(struct timeout_wheel *, struct timeout *);
+int	timeout_findbit(uint32_t *, int);
+int	timeout_coalesce(struct timeout_wheel *, int, int);
+int	timeout_wheel_next(struct timeout_wheel *, int);
+int	timeout_nsec_rearm(struct timeout_wheel *);
+uint64_t timeout_nsec_coalesce(struct timeout_wheel *, uint64_t, uint64_t);
+void	timeout_nsec_insert(struct timeout_wheel *, struct timeout *);
 
 /*
  * Circular queue definitions.
@@ -127,6 +178,14 @@ struct mutex timeout_mutex = MUTEX_INITIALIZER(IPL_HIGH);
 
 #define CIRCQ_EMPTY(elem) (CIRCQ_FIRST(elem) == (elem))
 
+/*
+ * Timeouts armed with an absolute deadline in nanoseconds of uptime don't
+ * go to the wheel.  They are kept sorted on tw_nsec instead and the
+ * first one is handed to the cpu's one-shot event timer (CLKEV_TIMEOUT),
+ * whose expiry schedules a softclock.  Without an event timer they fall
+ * back to ticks, rounded up.
+ */
+
 /*
  * Some of the "math" in here is a bit tricky.
  *
@@ -142,28 +201,318 @@ struct mutex timeout_mutex = MUTEX_INITIALIZER(IPL_HIGH);
  */
 
 void
-timeout_startup(void)
+timeout_wheel_init(struct timeout_wheel *tw)
+{
+	int b;
+
+	mtx_init(&tw->tw_mtx, IPL_HIGH);
+	CIRCQ_INIT(&tw->tw_todo);
+	CIRCQ_INIT(&tw->tw_nsec);
+	for (b = 0; b < nitems(tw->tw_wheel); b++)
+		CIRCQ_INIT(&tw->tw_wheel[b]);
+	tw->tw_ticks = ticks;
+	tw->tw_count = 0;
+	memset(tw->tw_bits, 0, sizeof(tw->tw_bits));
+	tw->tw_nextok = 0;
+	tw->tw_si = NULL;
+}
+
+/*
+ * Put the timeout into the bucket it is due in, or on the worklist
+ * if it is due already.
+ */
+void
+timeout_insert(struct timeout_wheel *tw, struct timeout *to)
 {
 	int b;
 
-	CIRCQ_INIT(&timeout_todo);
-	for (b = 0; b < nitems(timeout_wheel); b++)
-		CIRCQ_INIT(&timeout_wheel[b]);
+	if (to->to_time - tw->tw_ticks <= 0) {
+		CIRCQ_INSERT(&to->to_list, &tw->tw_todo);
+		return;
+	}
+
+	b = BUCKET(to->to_time - tw->tw_ticks, to->to_time);
+	if (to->to_flags & TIMEOUT_DEFERRABLE)
+		b += BUCKETS;
+	CIRCQ_INSERT(&to->to_list, &tw->tw_wheel[b]);
+	BUCKETBIT(tw, b) |= BUCKETMASK(b);
+	tw->tw_nextok = 0;
+}
+
+/*
+ * Take the timeout off whatever queue it is on.  If that leaves a
+ * bucket empty, its neighbours are both the bucket head.
+ */
+void
+timeout_remove(struct timeout_wheel *tw, struct timeout *to)
+{
+	struct circq *p = to->to_list.next;
+	int b;
+
+	if (p == to->to_list.prev && p >= &tw->tw_wheel[0] &&
+	    p < &tw->tw_wheel[nitems(tw->tw_wheel)]) {
+		b = p - tw->tw_wheel;
+		BUCKETBIT(tw, b) &= ~BUCKETMASK(b);
+		tw->tw_nextok = 0;
+	}
+	CIRCQ_REMOVE(&to->to_list);
+}
+
+void
+timeout_movebucket(struct timeout_wheel *tw, int b)
+{
+	if ((BUCKETBIT(tw, b) & BUCKETMASK(b)) == 0)
+		return;
+
+	CIRCQ_APPEND(&tw->tw_todo, &tw->tw_wheel[b]);
+	BUCKETBIT(tw, b) &= ~BUCKETMASK(b);
+	tw->tw_nextok = 0;
+}
+
+/*
+ * Return how many buckets after pos the first occupied bucket of
+ * a level is, going round, or -1 if there is none.
+ */
+int
+timeout_findbit(uint32_t *bits, int pos)
+{
+	uint32_t m;
+	int i, w;
+
+	for (i = 0; i <= WHEELWORDS; i++) {
+		w = ((pos / 32) + i) % WHEELWORDS;
+		m = bits[w];
+		if (i == 0)
+			m &= ~0U << (pos % 32);
+		else if (i == WHEELWORDS)
+			m &= ~(~0U << (pos % 32));
+		if (m != 0)
+			return ((w * 32 + ffs(m) - 1 - pos) & WHEELMASK);
+	}
+	return (-1);
+}
+
+/*
+ * Return the number of ticks after tw_ticks at which the next occupied
+ * bucket is moved to the worklist, INT_MAX if there is none.  The
+ * timeouts in a bucket of a higher level are due no earlier than that,
+ * so it is a safe time to wake up for.  The buckets of deferrable
+ * timeouts only count if asked for.  Called with the wheel locked.
+ */
+int
+timeout_wheel_next(struct timeout_wheel *tw, int deferrable)
+{
+	long long next[2], t0, t, period;
+	int level, d, i;
+
+	if (!tw->tw_nextok) {
+		next[0] = next[1] = INT_MAX;
+		for (level = 0; level < 2 * WHEELCOUNT; level++) {
+			/* A bucket of this level moves every period ticks. */
+			period = 1LL << ((level % WHEELCOUNT) * WHEELBITS);
+			t0 = ((long long)tw->tw_ticks | (period - 1)) + 1;
+			d = timeout_findbit(tw->tw_bits[level],
+			    MASKWHEEL(level % WHEELCOUNT, (int)t0));
+			if (d < 0)
+				continue;
+			t = t0 + d * period - tw->tw_ticks;
+			if (level < WHEELCOUNT && t < next[0])
+				next[0] = t;
+			if (t < next[1])
+				next[1] = t;
+		}
+		for (i = 0; i < 2; i++)
+			tw->tw_next[i] = (int)next[i];
+		tw->tw_nextbase = tw->tw_ticks;
+		tw->tw_nextok = 1;
+	}
+
+	i = deferrable ? 1 : 0;
+	if (tw->tw_next[i] == INT_MAX)
+		return (INT_MAX);
+	return (tw->tw_next[i] - (tw->tw_ticks - tw->tw_nextbase));
+}
+
+/*
+ * Return the number of ticks until the next timeout on the cpu's wheel
+ * needs attention, INT_MAX if there is none.  Deadline timeouts have
+ * an event of their own and are not considered.
+ */
+int
+timeout_next_expiry(struct cpu_info *ci)
+{
+	struct timeout_wheel *tw = ci->ci_schedstate.spc_wheel;
+	int next;
+
+	mtx_enter(&tw->tw_mtx);
+	if (!CIRCQ_EMPTY(&tw->tw_todo))
+		next = 0;
+	else
+		next = timeout_wheel_next(tw, 0);
+	mtx_leave(&tw->tw_mtx);
+
+	return (next);
+}
+
+void
+timeout_startup(void)
+{
+	timeout_wheel_init(&timeout_wheel_primary);
+	curcpu()->ci_schedstate.spc_wheel = &timeout_wheel_primary;
+}
+
+/*
+ * Give a cpu other than the boot one its wheel.
+ */
+void
+timeout_startup_cpu(struct cpu_info *ci)
+{
+	struct schedstate_percpu *spc = &ci->ci_schedstate;
+	struct timeout_wheel *tw;
+
+	if (spc->spc_wheel != NULL)
+		return;
+
+	tw = malloc(sizeof(*tw), M_DEVBUF, M_WAITOK);
+	timeout_wheel_init(tw);
+	spc->spc_wheel = tw;
+}
+
+/*
+ * Register a softclock for every wheel, bound to the wheel's cpu: run
+ * anywhere else, it would move rearming timeouts off their wheel.
+ * Called from initclocks() once all cpus have attached.
+ */
+void
+softclock_init(void)
+{
+	CPU_INFO_ITERATOR cii;
+	struct cpu_info *ci;
+	struct timeout_wheel *tw;
+
+	CPU_INFO_FOREACH(cii, ci) {
+		tw = ci->ci_schedstate.spc_wheel;
+		tw->tw_si = softintr_establish_cpu(ci, IPL_SOFTCLOCK,
+		    softclock, tw);
+		if (tw->tw_si == NULL)
+			panic("softclock_init: unable to register softclock intr");
+	}
+}
+
+/*
+ * Schedule the softclock of the current cpu.
+ */
+void
+softclock_schedule(void)
+{
+	softintr_schedule(curcpu()->ci_schedstate.spc_wheel->tw_si);
 }
 
 void
 timeout_set(struct timeout *new, void (*fn)(void *), void *arg)
+{
+	timeout_set_flags(new, fn, arg, 0);
+}
+
+void
+timeout_set_flags(struct timeout *new, void (*fn)(void *), void *arg,
+    int flags)
 {
 	new->to_func = fn;
 	new->to_arg = arg;
-	new->to_flags = TIMEOUT_INITIALIZED;
+	new->to_flags = flags | TIMEOUT_INITIALIZED;
+	new->to_wheel = NULL;
 }
 
+/*
+ * Lock the wheel the timeout belongs to.  Returns NULL, with nothing
+ * locked, if it was never added.
+ */
+struct timeout_wheel *
+timeout_lock(struct timeout *to)
+{
+	struct timeout_wheel *tw;
+
+	for (;;) {
+		tw = to->to_wheel;
+		if (tw == NULL)
+			return (NULL);
+		mtx_enter(&tw->tw_mtx);
+		if (tw == to->to_wheel)
+			return (tw);
+		mtx_leave(&tw->tw_mtx);
+	}
+}
+
+/*
+ * Move the timeout over to the current cpu's wheel, taking it off
+ * the queue it is on, and return that wheel locked.  *pending is set
+ * if the timeout was on a queue of another wheel.
+ */
+struct timeout_wheel *
+timeout_lock_cur(struct timeout *to, int *pending)
+{
+	struct timeout_wheel *tw, *cur = curcpu()->ci_schedstate.spc_wheel;
+
+	*pending = 0;
+	for (;;) {
+		tw = timeout_lock(to);
+		if (tw == cur)
+			return (tw);
+		if (tw == NULL) {
+			atomic_cas_ptr(&to->to_wheel, NULL, cur);
+			continue;
+		}
+
+		if (to->to_flags & TIMEOUT_ONQUEUE) {
+			timeout_remove(tw, to);
+			if ((to->to_flags & TIMEOUT_NSEC) == 0)
+				tw->tw_count--;
+			to->to_flags &= ~(TIMEOUT_ONQUEUE | TIMEOUT_NSEC);
+			*pending = 1;
+		}
+		to->to_wheel = cur;
+		mtx_leave(&tw->tw_mtx);
+	}
+}
+
+/*
+ * Pick the tick within [to_time, to_time + slack] that lets the timeout
+ * share a wakeup: one that already has a bucket of timeouts due, or else
+ * a multiple of the largest power of two within the slack, which other
+ * timeouts with slack tend to pick as well.  Called with the wheel locked.
+ */
+int
+timeout_coalesce(struct timeout_wheel *tw, int to_time, int slack)
+{
+	int rel = to_time - tw->tw_ticks;
+	int d, p;
+
+	if (slack <= 0 || rel <= 0)
+		return (to_time);
+
+	if (rel + slack <= WHEELSIZE) {
+		d = timeout_findbit(tw->tw_bits[0], MASKWHEEL(0, to_time));
+		if (d >= 0 && d <= slack)
+			return (to_time + d);
+	}
+
+	for (p = 1; p < (1 << 30) && p <= slack - p + 1; p *= 2)
+		;
+	return (to_time + (-to_time & (p - 1)));
+}
 
 int
 timeout_add(struct timeout *new, int to_ticks)
 {
-	int old_time;
+	return (timeout_add_slack(new, to_ticks, 0));
+}
+
+int
+timeout_add_slack(struct timeout *new, int to_ticks, int slack)
+{
+	struct timeout_wheel *tw;
+	int old_time, deferrable;
 	int ret = 1;
 
 #ifdef DIAGNOSTIC
@@ -171,12 +520,15 @@ timeout_add(struct timeout *new, int to_ticks)
 		panic("timeout_add: not initialized");
 	if (to_ticks < 0)
 		panic("timeout_add: to_ticks (%d) < 0", to_ticks);
+	if (slack < 0)
+		panic("timeout_add: slack (%d) < 0", slack);
 #endif
 
-	mtx_enter(&timeout_mutex);
+	tw = timeout_lock_cur(new, &ret);
+	ret = !ret;
 	/* Initialize the time here, it won't change. */
 	old_time = new->to_time;
-	new->to_time = to_ticks + ticks;
+	new->to_time = timeout_coalesce(tw, to_ticks + ticks, slack);
 	new->to_flags &= ~TIMEOUT_TRIGGERED;
 
 	/*
@@ -184,21 +536,163 @@ timeout_add(struct timeout *new, int to_ticks)
 	 * earlier, reschedule it now. Otherwise leave it in place
 	 * and let it be rescheduled later.
 	 */
-	if (new->to_flags & TIMEOUT_ONQUEUE) {
+	if (new->to_flags & TIMEOUT_NSEC) {
+		CIRCQ_REMOVE(&new->to_list);
+		timeout_insert(tw, new);
+		new->to_flags &= ~TIMEOUT_NSEC;
+		tw->tw_count++;
+		ret = 0;
+	} else if (new->to_flags & TIMEOUT_ONQUEUE) {
 		if (new->to_time - ticks < old_time - ticks) {
-			CIRCQ_REMOVE(&new->to_list);
-			CIRCQ_INSERT(&new->to_list, &timeout_todo);
+			timeout_remove(tw, new);
+			timeout_insert(tw, new);
 		}
 		ret = 0;
 	} else {
 		new->to_flags |= TIMEOUT_ONQUEUE;
-		CIRCQ_INSERT(&new->to_list, &timeout_todo);
+		timeout_insert(tw, new);
+		tw->tw_count++;
 	}
-	mtx_leave(&timeout_mutex);
+	deferrable = new->to_flags & TIMEOUT_DEFERRABLE;
+	mtx_leave(&tw->tw_mtx);
+
+	/* A cpu with its clock stopped has to notice the new timeout. */
+	if (!deferrable)
+		dynticks_kick(curcpu());
 
 	return (ret);
 }
 
+/*
+ * Arm the event timer for the first deadline on tw_nsec, which must be
+ * the current cpu's.  Called with the wheel locked.
+ */
+int
+timeout_nsec_rearm(struct timeout_wheel *tw)
+{
+	struct timeout *to;
+
+	if (CIRCQ_EMPTY(&tw->tw_nsec))
+		return (cpu_clockev_arm(CLKEV_TIMEOUT, CLKEV_NONE));
+
+	to = timeout_from_circq(CIRCQ_FIRST(&tw->tw_nsec));
+	return (cpu_clockev_arm(CLKEV_TIMEOUT, to->to_nsec));
+}
+
+/*
+ * Put the timeout on tw_nsec in deadline order.  Later deadlines
+ * are more common, so search from the back.
+ */
+void
+timeout_nsec_insert(struct timeout_wheel *tw, struct timeout *to)
+{
+	struct circq *p;
+
+	for (p = tw->tw_nsec.prev; p != &tw->tw_nsec; p = p->prev) {
+		if (timeout_from_circq(p)->to_nsec <= to->to_nsec)
+			break;
+	}
+	CIRCQ_INSERT(&to->to_list, p->next);
+	to->to_flags |= TIMEOUT_ONQUEUE | TIMEOUT_NSEC;
+}
+
+/*
+ * Pick a deadline within [deadline, deadline + slack] that lets the
+ * timeout share an event: the first one already on tw_nsec in that
+ * window, or else a multiple of the largest power of two within the
+ * slack, which other deadlines with slack tend to pick as well.
+ * Called with the wheel locked.
+ */
+uint64_t
+timeout_nsec_coalesce(struct timeout_wheel *tw, uint64_t deadline,
+    uint64_t slack)
+{
+	struct circq *p;
+	uint64_t nsec, g;
+
+	if (slack == 0)
+		return (deadline);
+
+	for (p = CIRCQ_FIRST(&tw->tw_nsec); p != &tw->tw_nsec;
+	    p = CIRCQ_FIRST(p)) {
+		nsec = timeout_from_circq(p)->to_nsec;
+		if (nsec < deadline)
+			continue;
+		if (nsec - deadline <= slack)
+			return (nsec);
+		break;
+	}
+
+	for (g = 1; g < (1ULL << 62) && g <= slack - g + 1; g *= 2)
+		;
+	return (deadline + (-deadline & (g - 1)));
+}
+
+int
+timeout_at_nsec(struct timeout *new, uint64_t deadline)
+{
+	return (timeout_at_nsec_slack(new, deadline, 0));
+}
+
+int
+timeout_at_nsec_slack(struct timeout *new, uint64_t deadline, uint64_t slack)
+{
+	struct timeout_wheel *tw;
+	uint64_t now, to_ticks;
+	int ret;
+
+#ifdef DIAGNOSTIC
+	if (!(new->to_flags & TIMEOUT_INITIALIZED))
+		panic("timeout_at_nsec: not initialized");
+#endif
+
+	tw = timeout_lock_cur(new, &ret);
+	ret = !ret;
+	if (new->to_flags & TIMEOUT_ONQUEUE) {
+		timeout_remove(tw, new);
+		if ((new->to_flags & TIMEOUT_NSEC) == 0)
+			tw->tw_count--;
+		new->to_flags &= ~(TIMEOUT_ONQUEUE | TIMEOUT_NSEC);
+		ret = 0;
+	}
+	new->to_flags &= ~TIMEOUT_TRIGGERED;
+	deadline = timeout_nsec_coalesce(tw, deadline, slack);
+	new->to_nsec = deadline;
+
+	/* Deferrable timeouts must not arm the event timer. */
+	if ((new->to_flags & TIMEOUT_DEFERRABLE) == 0) {
+		timeout_nsec_insert(tw, new);
+		if (CIRCQ_FIRST(&tw->tw_nsec) != &new->to_list ||
+		    timeout_nsec_rearm(tw) != 0) {
+			mtx_leave(&tw->tw_mtx);
+			return (ret);
+		}
+		/* No event timer, go with the wheel. */
+		CIRCQ_REMOVE(&new->to_list);
+		new->to_flags &= ~TIMEOUT_NSEC;
+	}
+
+	now = nsecuptime();
+	to_ticks = 0;
+	if (deadline > now)
+		to_ticks = (deadline - now + tick * 1000 - 1) / (tick * 1000);
+	if (to_ticks > INT_MAX)
+		to_ticks = INT_MAX;
+	new->to_time = ticks + (int)to_ticks;
+	new->to_flags |= TIMEOUT_ONQUEUE;
+	timeout_insert(tw, new);
+	tw->tw_count++;
+	mtx_leave(&tw->tw_mtx);
+
+	return (ret);
+}
+
+int
+timeout_at_ts(struct timeout *to, const struct timespec *ts)
+{
+	return (timeout_at_nsec(to, TIMESPEC_TO_NSEC(ts)));
+}
+
 int
 timeout_add_tv(struct timeout *to, const struct timeval *tv)
 {
@@ -263,60 +757,127 @@ timeout_add_msec(struct timeout *to, int msecs)
 int
 timeout_add_usec(struct timeout *to, int usecs)
 {
-	int to_ticks = usecs / tick;
+#ifdef DIAGNOSTIC
+	if (usecs < 0)
+		panic("timeout_add_usec: usecs (%d) < 0", usecs);
+#endif
 
-	return (timeout_add(to, to_ticks));
+	return (timeout_at_nsec(to, nsecuptime() + (uint64_t)usecs * 1000));
 }
 
 int
 timeout_add_nsec(struct timeout *to, int nsecs)
 {
-	int to_ticks = nsecs / (tick * 1000);
+#ifdef DIAGNOSTIC
+	if (nsecs < 0)
+		panic("timeout_add_nsec: nsecs (%d) < 0", nsecs);
+#endif
 
-	return (timeout_add(to, to_ticks));
+	return (timeout_at_nsec(to, nsecuptime() + nsecs));
 }
 
+
 int
 timeout_del(struct timeout *to)
 {
+	struct timeout_wheel *tw;
 	int ret = 0;
 
-	mtx_enter(&timeout_mutex);
+	if ((tw = timeout_lock(to)) == NULL)
+		return (0);
 	if (to->to_flags & TIMEOUT_ONQUEUE) {
-		CIRCQ_REMOVE(&to->to_list);
-		to->to_flags &= ~TIMEOUT_ONQUEUE;
+		timeout_remove(tw, to);
+		if ((to->to_flags & TIMEOUT_NSEC) == 0)
+			tw->tw_count--;
+		to->to_flags &= ~(TIMEOUT_ONQUEUE | TIMEOUT_NSEC);
 		ret = 1;
 	}
 	to->to_flags &= ~TIMEOUT_TRIGGERED;
-	mtx_leave(&timeout_mutex);
+	mtx_leave(&tw->tw_mtx);
 
 	return (ret);
 }
 
 /*
- * This is called from hardclock() once every tick.
+ * This is called from the clock interrupt when the CLKEV_TIMEOUT event
+ * of the current cpu expires.  Arm it for the first deadline still in
+ * the future; this cpu's softclock only has to run the due ones
+ * then.
+ */
+void
+timeout_nsec_expire(void)
+{
+	struct timeout_wheel *tw = curcpu()->ci_schedstate.spc_wheel;
+	struct circq *p;
+	uint64_t now;
+	int due = 0;
+
+	mtx_enter(&tw->tw_mtx);
+	now = nsecuptime();
+	for (p = CIRCQ_FIRST(&tw->tw_nsec); p != &tw->tw_nsec;
+	    p = CIRCQ_FIRST(p)) {
+		if (timeout_from_circq(p)->to_nsec > now)
+			break;
+		due = 1;
+	}
+	cpu_clockev_arm(CLKEV_TIMEOUT,
+	    p == &tw->tw_nsec ? CLKEV_NONE : timeout_from_circq(p)->to_nsec);
+	mtx_leave(&tw->tw_mtx);
+
+	if (due)
+		softintr_schedule(tw->tw_si);
+}
+
+/*
+ * This is called from hardclock() once every tick on every cpu.
  * We return !0 if we need to schedule a softclock.
  */
 int
 timeout_hardclock_update(void)
 {
-	int ret;
-
-	mtx_enter(&timeout_mutex);
+	struct cpu_info *ci = curcpu();
+	struct timeout_wheel *tw = ci->ci_schedstate.spc_wheel;
+	int ret, skip;
 
-	ticks++;
+	mtx_enter(&tw->tw_mtx);
 
-	MOVEBUCKET(0, ticks);
-	if (MASKWHEEL(0, ticks) == 0) {
-		MOVEBUCKET(1, ticks);
-		if (MASKWHEEL(1, ticks) == 0) {
-			MOVEBUCKET(2, ticks);
-			if (MASKWHEEL(2, ticks) == 0)
-				MOVEBUCKET(3, ticks);
+	/*
+	 * Catch up with the global ticks.  An empty wheel, like the one
+	 * of a cpu that has been tickless, can jump there right away and
+	 * the others skip the ticks that have no bucket to move.
+	 */
+	if (tw->tw_count == 0)
+		tw->tw_ticks = ticks;
+	while (tw->tw_ticks - ticks < 0) {
+		skip = timeout_wheel_next(tw, 1) - 1;
+		if (skip > 0) {
+			if (skip > ticks - tw->tw_ticks)
+				skip = ticks - tw->tw_ticks;
+			tw->tw_ticks += skip;
+			continue;
+		}
+		tw->tw_ticks++;
+		MOVEBUCKET(tw, 0, tw->tw_ticks);
+		if (MASKWHEEL(0, tw->tw_ticks) == 0) {
+			MOVEBUCKET(tw, 1, tw->tw_ticks);
+			if (MASKWHEEL(1, tw->tw_ticks) == 0) {
+				MOVEBUCKET(tw, 2, tw->tw_ticks);
+				if (MASKWHEEL(2, tw->tw_ticks) == 0)
+					MOVEBUCKET(tw, 3, tw->tw_ticks);
+			}
 		}
 	}
-	ret = !CIRCQ_EMPTY(&timeout_todo);
-	mtx_leave(&timeout_mutex);
+	ret = !CIRCQ_EMPTY(&tw->tw_todo);
+
+	/*
+	 * Catch deadlines whose event went astray, e.g. when it was
+	 * armed before this cpu started its clock.
+	 */
+	if (!ret && !CIRCQ_EMPTY(&tw->tw_nsec) &&
+	    timeout_from_circq(CIRCQ_FIRST(&tw->tw_nsec))->to_nsec <=
+	    nsecuptime())
+		ret = 1;
+	mtx_leave(&tw->tw_mtx);
 
 	return (ret);
 }
@@ -324,43 +885,103 @@ timeout_hardclock_update(void)
 void
 softclock(void *arg)
 {
+	struct timeout_wheel *tw = arg;
 	struct timeout *to;
 	void (*fn)(void *);
+	uint64_t now;
+
+	mtx_enter(&tw->tw_mtx);
+	now = nsecuptime();
+	while (!CIRCQ_EMPTY(&tw->tw_nsec)) {
+		to = timeout_from_circq(CIRCQ_FIRST(&tw->tw_nsec));
+		if (to->to_nsec > now)
+			break;
+		CIRCQ_REMOVE(&to->to_list);
+		to->to_flags &= ~(TIMEOUT_ONQUEUE | TIMEOUT_NSEC);
+		to->to_flags |= TIMEOUT_TRIGGERED;
+
+		fn = to->to_func;
+		arg = to->to_arg;
+
+		mtx_leave(&tw->tw_mtx);
+		fn(arg);
+		mtx_enter(&tw->tw_mtx);
+	}
 
-	mtx_enter(&timeout_mutex);
-	while (!CIRCQ_EMPTY(&timeout_todo)) {
+	while (!CIRCQ_EMPTY(&tw->tw_todo)) {
 
-		to = timeout_from_circq(CIRCQ_FIRST(&timeout_todo));
+		to = timeout_from_circq(CIRCQ_FIRST(&tw->tw_todo));
 		CIRCQ_REMOVE(&to->to_list);
 
 		/* If due run it, otherwise insert it into the right bucket. */
-		if (to->to_time - ticks > 0) {
-			CIRCQ_INSERT(&to->to_list,
-			    &BUCKET((to->to_time - ticks), to->to_time));
+		if (to->to_time - tw->tw_ticks > 0) {
+			timeout_insert(tw, to);
 		} else {
 #ifdef DEBUG
-			if (to->to_time - ticks < 0)
+			if (to->to_time - tw->tw_ticks < 0)
 				printf("timeout delayed %d\n", to->to_time -
-				    ticks);
+				    tw->tw_ticks);
 #endif
 			to->to_flags &= ~TIMEOUT_ONQUEUE;
 			to->to_flags |= TIMEOUT_TRIGGERED;
+			tw->tw_count--;
 
 			fn = to->to_func;
 			arg = to->to_arg;
 
-			mtx_leave(&timeout_mutex);
+			mtx_leave(&tw->tw_mtx);
 			fn(arg);
-			mtx_enter(&timeout_mutex);
+			mtx_enter(&tw->tw_mtx);
 		}
 	}
-	mtx_leave(&timeout_mutex);
+	mtx_leave(&tw->tw_mtx);
+}
+
+/*
+ * Move all timeouts of a cpu that goes offline to the current cpu.
+ */
+void
+timeout_migrate(struct cpu_info *ci)
+{
+	struct timeout_wheel *otw = ci->ci_schedstate.spc_wheel;
+	struct timeout_wheel *tw = curcpu()->ci_schedstate.spc_wheel;
+	struct timeout *to;
+	struct circq *p;
+	int b;
+
+	if (otw == tw)
+		return;
+
+	/* Nothing else holds two wheel locks. */
+	mtx_enter(&otw->tw_mtx);
+	mtx_enter(&tw->tw_mtx);
+	for (b = 0; b < nitems(otw->tw_wheel); b++)
+		timeout_movebucket(otw, b);
+	for (p = CIRCQ_FIRST(&otw->tw_todo); p != &otw->tw_todo;
+	    p = CIRCQ_FIRST(p))
+		timeout_from_circq(p)->to_wheel = tw;
+	CIRCQ_APPEND(&tw->tw_todo, &otw->tw_todo);
+	tw->tw_count += otw->tw_count;
+	otw->tw_count = 0;
+
+	while (!CIRCQ_EMPTY(&otw->tw_nsec)) {
+		to = timeout_from_circq(CIRCQ_FIRST(&otw->tw_nsec));
+		CIRCQ_REMOVE(&to->to_list);
+		to->to_wheel = tw;
+		timeout_nsec_insert(tw, to);
+	}
+	timeout_nsec_rearm(tw);
+	mtx_leave(&tw->tw_mtx);
+	mtx_leave(&otw->tw_mtx);
 }
 
 #ifndef SMALL_KERNEL
 void
 timeout_adjust_ticks(int adj)
 {
+	CPU_INFO_ITERATOR cii;
+	struct cpu_info *ci;
+	struct timeout_wheel *tw;
 	struct timeout *to;
 	struct circq *p;
 	int new_ticks, b;
@@ -369,31 +990,41 @@ timeout_adjust_ticks(int adj)
 	if (adj <= 0)
 		return;
 
-	mtx_enter(&timeout_mutex);
 	new_ticks = ticks + adj;
-	for (b = 0; b < nitems(timeout_wheel); b++) {
-		p = CIRCQ_FIRST(&timeout_wheel[b]);
-		while (p != &timeout_wheel[b]) {
-			to = timeout_from_circq(p);
-			p = CIRCQ_FIRST(p);
-
-			/* when moving a timeout forward need to reinsert it */
-			if (to->to_time - ticks < adj)
-				to->to_time = new_ticks;
-			CIRCQ_REMOVE(&to->to_list);
-			CIRCQ_INSERT(&to->to_list, &timeout_todo);
+	CPU_INFO_FOREACH(cii, ci) {
+		tw = ci->ci_schedstate.spc_wheel;
+		mtx_enter(&tw->tw_mtx);
+		for (b = 0; b < nitems(tw->tw_wheel); b++) {
+			p = CIRCQ_FIRST(&tw->tw_wheel[b]);
+			while (p != &tw->tw_wheel[b]) {
+				to = timeout_from_circq(p);
+				p = CIRCQ_FIRST(p);
+
+				/*
+				 * when moving a timeout forward need to
+				 * reinsert it
+				 */
+				if (to->to_time - ticks < adj)
+					to->to_time = new_ticks;
+				CIRCQ_REMOVE(&to->to_list);
+				CIRCQ_INSERT(&to->to_list, &tw->tw_todo);
+			}
 		}
+		memset(tw->tw_bits, 0, sizeof(tw->tw_bits));
+		tw->tw_nextok = 0;
+		tw->tw_ticks = new_ticks;
+		mtx_leave(&tw->tw_mtx);
 	}
 	ticks = new_ticks;
-	mtx_leave(&timeout_mutex);
 }
 #endif
 
 #ifdef DDB
-void db_show_callout_bucket(struct circq *);
+void db_show_callout_bucket(struct timeout_wheel *, struct circq *);
+void db_show_callout_nsec(struct timeout_wheel *);
 
 void
-db_show_callout_bucket(struct circq *bucket)
+db_show_callout_bucket(struct timeout_wheel *tw, struct circq *bucket)
 {
 	struct timeout *to;
 	struct circq *p;
@@ -404,22 +1035,49 @@ db_show_callout_bucket(struct circq *bucket)
 		to = timeout_from_circq(p);
 		db_find_sym_and_offset((db_addr_t)to->to_func, &name, &offset);
 		name = name ? name : "?";
-		db_printf("%9d %2td/%-4td %p  %s\n", to->to_time - ticks,
-		    (bucket - timeout_wheel) / WHEELSIZE,
-		    bucket - timeout_wheel, to->to_arg, name);
+		db_printf("%9d %2td/%-4td %p  %s\n", to->to_time - tw->tw_ticks,
+		    (bucket - tw->tw_wheel) / WHEELSIZE,
+		    bucket - tw->tw_wheel, to->to_arg, name);
+	}
+}
+
+void
+db_show_callout_nsec(struct timeout_wheel *tw)
+{
+	struct timeout *to;
+	struct circq *p;
+	db_expr_t offset;
+	char *name;
+
+	db_printf("       nsec                   arg  func\n");
+	for (p = CIRCQ_FIRST(&tw->tw_nsec); p != &tw->tw_nsec;
+	    p = CIRCQ_FIRST(p)) {
+		to = timeout_from_circq(p);
+		db_find_sym_and_offset((db_addr_t)to->to_func, &name, &offset);
+		name = name ? name : "?";
+		db_printf("%20llu %p  %s\n", to->to_nsec, to->to_arg, name);
 	}
 }
 
 void
 db_show_callout(db_expr_t addr, int haddr, db_expr_t count, char *modif)
 {
+	CPU_INFO_ITERATOR cii;
+	struct cpu_info *ci;
+	struct timeout_wheel *tw;
 	int b;
 
 	db_printf("ticks now: %d\n", ticks);
-	db_printf("    ticks  wheel       arg  func\n");
-
-	db_show_callout_bucket(&timeout_todo);
-	for (b = 0; b < nitems(timeout_wheel); b++)
-		db_show_callout_bucket(&timeout_wheel[b]);
+	CPU_INFO_FOREACH(cii, ci) {
+		tw = ci->ci_schedstate.spc_wheel;
+		db_printf("cpu%d wheel at: %d\n", CPU_INFO_UNIT(ci),
+		    tw->tw_ticks);
+		db_printf("    ticks  wheel       arg  func\n");
+
+		db_show_callout_bucket(tw, &tw->tw_todo);
+		for (b = 0; b < nitems(tw->tw_wheel); b++)
+			db_show_callout_bucket(tw, &tw->tw_wheel[b]);
+		db_show_callout_nsec(tw);
+	}
 }
 #endif
@@ -54,7 +54,8 @@ wdog_tickle(void *arg)
 	if (wdog_ctl_cb == NULL)
 		return;
 	(void) (*wdog_ctl_cb)(wdog_ctl_cb_arg, wdog_period);
-	timeout_add(&wdog_timeout, wdog_period * hz / 2);
+	timeout_add_slack(&wdog_timeout, wdog_period * hz / 2,
+	    wdog_period * hz / 4);
 }
 
 void
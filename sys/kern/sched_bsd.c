@@ -54,7 +54,7 @@
 
 
 int	lbolt;			/* once a second sleep address */
-int	rrticks_init;		/* # of hardclock ticks per roundrobin() */
+u_int64_t rrquantum = 100000000;	/* # of nsec per roundrobin() quantum */
 
 #ifdef MULTIPROCESSOR
 struct __mp_lock sched_lock;
@@ -70,43 +70,56 @@ scheduler_start(void)
 	/*
 	 * We avoid polluting the global namespace by keeping the scheduler
 	 * timeouts static in this function.
-	 * We setup the timeouts here and kick schedcpu and roundrobin once to
-	 * make them do their job.
+	 * We setup the timeouts here and kick schedcpu once to make it do
+	 * its job.
 	 */
 
-	timeout_set(&schedcpu_to, schedcpu, &schedcpu_to);
+	timeout_set_flags(&schedcpu_to, schedcpu, &schedcpu_to,
+	    TIMEOUT_DEFERRABLE);
 
-	rrticks_init = hz / 10;
 	schedcpu(&schedcpu_to);
 }
 
 /*
- * Force switch among equal priority processes every 100ms.
+ * Start the quantum of the thread running on ci, now that another
+ * one is waiting for that cpu.  Only the cpu itself can arm its
+ * event timer, so a remote one picks the deadline up at its next
+ * hardclock.
+ */
+void
+roundrobin_arm(struct cpu_info *ci)
+{
+	struct schedstate_percpu *spc = &ci->ci_schedstate;
+
+	SCHED_ASSERT_LOCKED();
+
+	if (spc->spc_rrdeadline != CLKEV_NONE || ci->ci_curproc == NULL ||
+	    ci->ci_curproc == spc->spc_idleproc)
+		return;
+
+	spc->spc_rrdeadline = nsecuptime() + rrquantum;
+	if (ci == curcpu())
+		cpu_clockev_arm(CLKEV_ROUNDROBIN, spc->spc_rrdeadline);
+	else
+		atomic_setbits_int(&spc->spc_schedflags, SPCF_RRARM);
+}
+
+/*
+ * The running thread has used up its quantum: force a switch if
+ * something else still wants this cpu.
  */
 void
 roundrobin(struct cpu_info *ci)
 {
 	struct schedstate_percpu *spc = &ci->ci_schedstate;
 
-	spc->spc_rrticks = rrticks_init;
-
-	if (ci->ci_curproc != NULL) {
-		if (spc->spc_schedflags & SPCF_SEENRR) {
-			/*
-			 * The process has already been through a roundrobin
-			 * without switching and may be hogging the CPU.
-			 * Indicate that the process should yield.
-			 */
-			atomic_setbits_int(&spc->spc_schedflags,
-			    SPCF_SHOULDYIELD);
-		} else {
-			atomic_setbits_int(&spc->spc_schedflags,
-			    SPCF_SEENRR);
-		}
-	}
+	spc->spc_rrdeadline = CLKEV_NONE;
+	if (spc->spc_nrun == 0)
+		return;
 
-	if (spc->spc_nrun)
-		need_resched(ci);
+	if (ci->ci_curproc != NULL)
+		atomic_setbits_int(&spc->spc_schedflags, SPCF_SHOULDYIELD);
+	need_resched(ci);
 }
 
 /*
@@ -251,18 +264,17 @@ schedcpu(void *arg)
 		if (p->p_priority >= PUSER) {
 			if (p->p_stat == SRUN &&
 			    (p->p_priority / SCHED_PPQ) !=
-			    (p->p_usrpri / SCHED_PPQ)) {
-				remrunqueue(p);
-				p->p_priority = p->p_usrpri;
-				setrunqueue(p);
-			} else
+			    (p->p_usrpri / SCHED_PPQ))
+				sched_setpriority(p, p->p_usrpri);
+			else
 				p->p_priority = p->p_usrpri;
 		}
 		SCHED_UNLOCK(s);
 	}
 	uvm_meter();
 	wakeup(&lbolt);
-	timeout_add_sec(to, 1);
+	/* Keep the load average and lbolt close to once a second. */
+	timeout_add_slack(to, hz, hz / 10);
 }
 
 /*
@@ -356,11 +368,14 @@ mi_switch(void)
 
 	SCHED_ASSERT_LOCKED();
 
+	/* The next thread may need the clock. */
+	dynticks_leave(curcpu(), p);
+	cpustate_switch(CP_SYS);
+
 #ifdef MULTIPROCESSOR
 	/*
 	 * Release the kernel_lock, as we are about to yield the CPU.
 	 */
-	sched_count = __mp_release_all_but_one(&sched_lock);
 	if (__mp_lock_held(&kernel_lock))
 		hold_count = __mp_release_all(&kernel_lock);
 	else
@@ -410,29 +425,41 @@ mi_switch(void)
 	 */
 	atomic_clearbits_int(&spc->spc_schedflags, SPCF_SWITCHCLEAR);
 
+	/*
+	 * The run queues have their own locks, and p_oncpu keeps other
+	 * cpus from running p before cpu_switchto() is done with it.
+	 * So sched_lock is not needed for the switch itself.
+	 */
+#ifdef MULTIPROCESSOR
+	sched_count = __mp_release_all(&sched_lock);
+#endif
+
 	nextproc = sched_chooseproc();
 
+	/*
+	 * The quantum ends with the switch.  Start one for the next
+	 * thread right away if others are still waiting.
+	 */
+	if (spc->spc_rrdeadline != CLKEV_NONE || spc->spc_nrun != 0) {
+		atomic_clearbits_int(&spc->spc_schedflags, SPCF_RRARM);
+		if (spc->spc_nrun != 0 && nextproc != spc->spc_idleproc)
+			spc->spc_rrdeadline = nsecuptime() + rrquantum;
+		else
+			spc->spc_rrdeadline = CLKEV_NONE;
+		cpu_clockev_arm(CLKEV_ROUNDROBIN, spc->spc_rrdeadline);
+	}
+
 	if (p != nextproc) {
 		uvmexp.swtch++;
+		spc->spc_prevproc = p;
 		cpu_switchto(p, nextproc);
+		sched_switched();
 	} else {
 		p->p_stat = SONPROC;
 	}
 
 	clear_resched(curcpu());
 
-	SCHED_ASSERT_LOCKED();
-
-	/*
-	 * To preserve lock ordering, we need to release the sched lock
-	 * and grab it after we grab the big lock.
-	 * In the future, when the sched lock isn't recursive, we'll
-	 * just release it here.
-	 */
-#ifdef MULTIPROCESSOR
-	__mp_unlock(&sched_lock);
-#endif
-
 	SCHED_ASSERT_UNLOCKED();
 
 	/*
@@ -452,7 +479,7 @@ mi_switch(void)
 	 */
 	if (hold_count)
 		__mp_acquire_count(&kernel_lock, hold_count);
-	__mp_acquire_count(&sched_lock, sched_count + 1);
+	__mp_acquire_count(&sched_lock, sched_count);
 #endif
 }
 
@@ -592,6 +619,7 @@ setperf_auto(void *v)
 	CPU_INFO_ITERATOR cii;
 	struct cpu_info *ci;
 	uint64_t idle, total, allidle, alltotal;
+	uint64_t cp_time[CPUSTATES];
 
 	if (perfpolicy != PERFPOL_AUTO)
 		return;
@@ -612,12 +640,13 @@ setperf_auto(void *v)
 	j = 0;
 	speedup = 0;
 	CPU_INFO_FOREACH(cii, ci) {
+		cpustate_cp_time(ci, cp_time);
 		total = 0;
 		for (i = 0; i < CPUSTATES; i++) {
-			total += ci->ci_schedstate.spc_cp_time[i];
+			total += cp_time[i];
 		}
 		total -= totalticks[j];
-		idle = ci->ci_schedstate.spc_cp_time[CP_IDLE] - idleticks[j];
+		idle = cp_time[CP_IDLE] - idleticks[j];
 		if (idle < total / 3)
 			speedup = 1;
 		alltotal += total;
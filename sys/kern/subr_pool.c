@@ -159,7 +159,8 @@ void	 pool_print1(struct pool *, const char *, int (*)(const char *, ...)
 
 /* stale page garbage collectors */
 void	pool_gc_sched(void *);
-struct timeout pool_gc_tick = TIMEOUT_INITIALIZER(pool_gc_sched, NULL);
+struct timeout pool_gc_tick = TIMEOUT_INITIALIZER_FLAGS(pool_gc_sched, NULL,
+    TIMEOUT_DEFERRABLE);
 void	pool_gc_pages(void *);
 struct task pool_gc_task = TASK_INITIALIZER(pool_gc_pages, NULL);
 int pool_wait_free = 1;
@@ -1393,7 +1394,7 @@ pool_gc_pages(void *null)
 	splx(s);
 	rw_exit_read(&pool_lock);
 
-	timeout_add_sec(&pool_gc_tick, 1);
+	timeout_add_slack(&pool_gc_tick, hz, hz / 2);
 }
 
 /*
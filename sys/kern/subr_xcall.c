@@ -1,4 +1,4 @@
-/*	$NetBSD$	*/
+/*	$OpenBSD$	*/
 
 /*-
  * Copyright (c) 2007-2010 The NetBSD Foundation, Inc.
@@ -68,381 +68,342 @@
  *	them (and memory allocation may need to wait on the pagedaemon).
  *
  *	A low-overhead mechanism for high priority calls (XC_HIGHPRI) is
- *	also provided.  The function to be executed runs on a software
- *	interrupt context, at IPL_SOFTSERIAL level, and is expected to
- *	be very lightweight, e.g. avoid blocking.
+ *	also provided.  The function to be executed runs straight from
+ *	the cross-call IPI on the target CPU, at IPL_IPI and without the
+ *	kernel lock.  It must be very lightweight: it may not sleep, and
+ *	it may not take any lock that the code it interrupted could be
+ *	holding.  Waiting for a high priority call spins, so it must not
+ *	be done at IPL_IPI.
  */
 
-#if 0
-#include <sys/cdefs.h>
-__KERNEL_RCSID(0, "$NetBSD$");
-#endif
-
-#include <sys/types.h>
 #include <sys/param.h>
-#include <sys/xcall.h>
+#include <sys/systm.h>
+#include <sys/proc.h>
 #include <sys/mutex.h>
-#if 0
-#include <sys/condvar.h>
-#include <sys/evcnt.h>
-#endif
 #include <sys/kthread.h>
-#if 0
-#include <sys/cpu.h>
-#endif
-
-#if 1
-#define	__cacheline_aligned	// XXX
-#define	kmutex_t struct mutex
-#endif
+#include <sys/sched.h>
+#include <sys/xcall.h>
 
-#if 0
-#ifdef _RUMPKERNEL
-#include "rump_private.h"
-#endif
-#endif
+#include <machine/atomic.h>
+#include <machine/cpu.h>
+#include <machine/intr.h>
 
 /* Cross-call state box. */
 typedef struct {
-	kmutex_t	xc_lock;
-#if 0
-	kcondvar_t	xc_busy;
-#else
-	void		*xc_busy;
-#endif
+	struct mutex	xc_lock;
 	xcfunc_t	xc_func;
-	void *		xc_arg1;
-	void *		xc_arg2;
-	uint64_t	xc_headp;
-	uint64_t	xc_donep;
+	void		*xc_arg1;
+	void		*xc_arg2;
+	volatile uint64_t xc_headp;
+	volatile uint64_t xc_donep;
 } xc_state_t;
 
+/* Per-CPU state. */
+struct xc_cpu {
+	volatile int	xcc_pending;	/* low priority call waiting */
+	volatile u_int	xcc_hipending;	/* high priority call waiting */
+};
+
 /* Bit indicating high (1) or low (0) priority. */
 #define	XC_PRI_BIT	(1ULL << 63)
 
-#if 0
 /* Low priority xcall structures. */
-static xc_state_t	xc_low_pri	__cacheline_aligned;
-static uint64_t		xc_tailp	__cacheline_aligned;
+xc_state_t	xc_low_pri;
+uint64_t	xc_tailp;
 
 /* High priority xcall structures. */
-static xc_state_t	xc_high_pri	__cacheline_aligned;
-static void *		xc_sih		__cacheline_aligned;
+xc_state_t	xc_high_pri;
 
-/* Event counters. */
-static struct evcnt	xc_unicast_ev	__cacheline_aligned;
-static struct evcnt	xc_broadcast_ev	__cacheline_aligned;
+struct xc_cpu	xc_cpus[MAXCPUS];
 
-static void		xc_init(void);
-static void		xc_thread(void *);
+void		xc_init(void);
+void		xc_thread(void *);
+void		xc_thread_create(void *);
+int		xc_cpu_ok(struct cpu_info *);
 
-static inline uint64_t	xc_highpri(xcfunc_t, void *, void *, struct cpu_info *);
-static inline uint64_t	xc_lowpri(xcfunc_t, void *, void *, struct cpu_info *);
-#endif
+uint64_t	xc_highpri(xcfunc_t, void *, void *, struct cpu_info *);
+uint64_t	xc_lowpri(xcfunc_t, void *, void *, struct cpu_info *);
 
-#if 0
 /*
- * xc_init:
- *
- *	Initialize low and high priority cross-call structures.
+ * Initialize the low and high priority cross-call state.
  */
-static void
+void
 xc_init(void)
 {
 	xc_state_t *xclo = &xc_low_pri, *xchi = &xc_high_pri;
 
 	memset(xclo, 0, sizeof(xc_state_t));
-	mutex_init(&xclo->xc_lock, MUTEX_DEFAULT, IPL_NONE);
-	cv_init(&xclo->xc_busy, "xclocv");
+	mtx_init(&xclo->xc_lock, IPL_NONE);
 	xc_tailp = 0;
 
+	/* The IPI handler takes this one. */
 	memset(xchi, 0, sizeof(xc_state_t));
-	mutex_init(&xchi->xc_lock, MUTEX_DEFAULT, IPL_SOFTSERIAL);
-	cv_init(&xchi->xc_busy, "xchicv");
-	xc_sih = softint_establish(SOFTINT_SERIAL | SOFTINT_MPSAFE,
-	    xc__highpri_intr, NULL);
-	KASSERT(xc_sih != NULL);
-
-	evcnt_attach_dynamic(&xc_unicast_ev, EVCNT_TYPE_MISC, NULL,
-	   "crosscall", "unicast");
-	evcnt_attach_dynamic(&xc_broadcast_ev, EVCNT_TYPE_MISC, NULL,
-	   "crosscall", "broadcast");
+	mtx_init(&xchi->xc_lock, IPL_IPI);
 }
 
 /*
- * xc_init_cpu:
- *
- *	Initialize the cross-call subsystem.  Called once for each CPU
- *	in the system as they are attached.
+ * Called once for each cpu in the system as it attaches.
  */
 void
 xc_init_cpu(struct cpu_info *ci)
 {
-	static bool again = false;
-	int error __diagused;
+	static int again = 0;
+	struct xc_cpu *xcc = &xc_cpus[CPU_INFO_UNIT(ci)];
 
 	if (!again) {
 		/* Autoconfiguration will prevent re-entry. */
 		xc_init();
-		again = true;
+		again = 1;
 	}
-	cv_init(&ci->ci_data.cpu_xcall, "xcall");
-	error = kthread_create(PRI_XCALL, KTHREAD_MPSAFE, ci, xc_thread,
-	    NULL, NULL, "xcall/%u", ci->ci_index);
-	KASSERT(error == 0);
+
+	xcc->xcc_pending = 0;
+	xcc->xcc_hipending = 0;
+	kthread_create_deferred(xc_thread_create, ci);
+}
+
+void
+xc_thread_create(void *arg)
+{
+	struct cpu_info *ci = arg;
+	char name[MAXCOMLEN + 1];
+
+	snprintf(name, sizeof(name), "xcall%d", CPU_INFO_UNIT(ci));
+	if (kthread_create(xc_thread, ci, NULL, name))
+		panic("xc_thread_create");
 }
 
 /*
- * xc_broadcast:
- *
- *	Trigger a call on all CPUs in the system.
+ * Can the cpu take cross calls?  Halted cpus don't run anything.
+ */
+int
+xc_cpu_ok(struct cpu_info *ci)
+{
+	return ((ci->ci_schedstate.spc_schedflags &
+	    (SPCF_SHOULDHALT | SPCF_HALTED)) == 0);
+}
+
+/*
+ * Trigger a call on all cpus in the system.
  */
 uint64_t
 xc_broadcast(u_int flags, xcfunc_t func, void *arg1, void *arg2)
 {
-
-	KASSERT(!cpu_intr_p() && !cpu_softintr_p());
-
-	if ((flags & XC_HIGHPRI) != 0) {
-		return xc_highpri(func, arg1, arg2, NULL);
-	} else {
-		return xc_lowpri(func, arg1, arg2, NULL);
-	}
+	if (flags & XC_HIGHPRI)
+		return (xc_highpri(func, arg1, arg2, NULL));
+	return (xc_lowpri(func, arg1, arg2, NULL));
 }
 
 /*
- * xc_unicast:
- *
- *	Trigger a call on one CPU.
+ * Trigger a call on one cpu.
  */
 uint64_t
 xc_unicast(u_int flags, xcfunc_t func, void *arg1, void *arg2,
-	   struct cpu_info *ci)
+    struct cpu_info *ci)
 {
-
 	KASSERT(ci != NULL);
-	KASSERT(!cpu_intr_p() && !cpu_softintr_p());
 
-	if ((flags & XC_HIGHPRI) != 0) {
-		return xc_highpri(func, arg1, arg2, ci);
-	} else {
-		return xc_lowpri(func, arg1, arg2, ci);
-	}
+	if (flags & XC_HIGHPRI)
+		return (xc_highpri(func, arg1, arg2, ci));
+	return (xc_lowpri(func, arg1, arg2, ci));
 }
 
 /*
- * xc_wait:
- *
- *	Wait for a cross call to complete.
+ * Wait for a cross call to complete.
  */
 void
 xc_wait(uint64_t where)
 {
 	xc_state_t *xc;
 
-	KASSERT(!cpu_intr_p() && !cpu_softintr_p());
-
-	/* Determine whether it is high or low priority cross-call. */
-	if ((where & XC_PRI_BIT) != 0) {
+	if (where & XC_PRI_BIT) {
+		/* The IPI handlers don't wake anybody up; spin. */
 		xc = &xc_high_pri;
 		where &= ~XC_PRI_BIT;
-	} else {
-		xc = &xc_low_pri;
+		while (xc->xc_donep < where)
+			CPU_BUSY_CYCLE();
+		return;
 	}
 
-	/* Fast path, if already done. */
-	if (xc->xc_donep >= where) {
+	xc = &xc_low_pri;
+	if (xc->xc_donep >= where)
 		return;
-	}
 
-	/* Slow path: block until awoken. */
-	mutex_enter(&xc->xc_lock);
-	while (xc->xc_donep < where) {
-		cv_wait(&xc->xc_busy, &xc->xc_lock);
-	}
-	mutex_exit(&xc->xc_lock);
+	mtx_enter(&xc->xc_lock);
+	while (xc->xc_donep < where)
+		msleep(&xc->xc_donep, &xc->xc_lock, PWAIT, "xcwait", 0);
+	mtx_leave(&xc->xc_lock);
 }
 
 /*
- * xc_lowpri:
- *
- *	Trigger a low priority call on one or more CPUs.
+ * Trigger a low priority call on one or more cpus.
  */
-static inline uint64_t
+uint64_t
 xc_lowpri(xcfunc_t func, void *arg1, void *arg2, struct cpu_info *ci)
 {
 	xc_state_t *xc = &xc_low_pri;
 	CPU_INFO_ITERATOR cii;
 	uint64_t where;
 
-	mutex_enter(&xc->xc_lock);
-	while (xc->xc_headp != xc_tailp) {
-		cv_wait(&xc->xc_busy, &xc->xc_lock);
-	}
+	mtx_enter(&xc->xc_lock);
+	while (xc->xc_headp != xc_tailp)
+		msleep(&xc->xc_headp, &xc->xc_lock, PWAIT, "xcbusy", 0);
 	xc->xc_arg1 = arg1;
 	xc->xc_arg2 = arg2;
 	xc->xc_func = func;
 	if (ci == NULL) {
-		xc_broadcast_ev.ev_count++;
-		for (CPU_INFO_FOREACH(cii, ci)) {
-			if ((ci->ci_schedstate.spc_flags & SPCF_RUNNING) == 0)
+		CPU_INFO_FOREACH(cii, ci) {
+			if (!xc_cpu_ok(ci))
 				continue;
-			xc->xc_headp += 1;
-			ci->ci_data.cpu_xcall_pending = true;
-			cv_signal(&ci->ci_data.cpu_xcall);
+			xc->xc_headp++;
+			xc_cpus[CPU_INFO_UNIT(ci)].xcc_pending = 1;
+			wakeup(&xc_cpus[CPU_INFO_UNIT(ci)]);
 		}
 	} else {
-		xc_unicast_ev.ev_count++;
-		xc->xc_headp += 1;
-		ci->ci_data.cpu_xcall_pending = true;
-		cv_signal(&ci->ci_data.cpu_xcall);
+		xc->xc_headp++;
+		xc_cpus[CPU_INFO_UNIT(ci)].xcc_pending = 1;
+		wakeup(&xc_cpus[CPU_INFO_UNIT(ci)]);
 	}
-	KASSERT(xc_tailp < xc->xc_headp);
 	where = xc->xc_headp;
-	mutex_exit(&xc->xc_lock);
+	mtx_leave(&xc->xc_lock);
 
 	/* Return a low priority ticket. */
 	KASSERT((where & XC_PRI_BIT) == 0);
-	return where;
+	return (where);
 }
 
 /*
- * xc_thread:
- *
- *	One thread per-CPU to dispatch low priority calls.
+ * One thread per cpu dispatches the low priority calls.
  */
-static void
-xc_thread(void *cookie)
+void
+xc_thread(void *arg)
 {
-	struct cpu_info *ci = curcpu();
+	struct cpu_info *ci = arg;
+	struct xc_cpu *xcc = &xc_cpus[CPU_INFO_UNIT(ci)];
 	xc_state_t *xc = &xc_low_pri;
 	void *arg1, *arg2;
 	xcfunc_t func;
 
-	mutex_enter(&xc->xc_lock);
+	sched_peg_curproc(ci);
+
+	mtx_enter(&xc->xc_lock);
 	for (;;) {
-		while (!ci->ci_data.cpu_xcall_pending) {
-			if (xc->xc_headp == xc_tailp) {
-				cv_broadcast(&xc->xc_busy);
-			}
-			cv_wait(&ci->ci_data.cpu_xcall, &xc->xc_lock);
+		while (!xcc->xcc_pending) {
+			if (xc->xc_headp == xc_tailp)
+				wakeup(&xc->xc_headp);
+			msleep(xcc, &xc->xc_lock, PWAIT, "xcall", 0);
 			KASSERT(ci == curcpu());
 		}
-		ci->ci_data.cpu_xcall_pending = false;
+		xcc->xcc_pending = 0;
 		func = xc->xc_func;
 		arg1 = xc->xc_arg1;
 		arg2 = xc->xc_arg2;
 		xc_tailp++;
-		mutex_exit(&xc->xc_lock);
+		mtx_leave(&xc->xc_lock);
 
 		KASSERT(func != NULL);
 		(*func)(arg1, arg2);
 
-		mutex_enter(&xc->xc_lock);
+		mtx_enter(&xc->xc_lock);
 		xc->xc_donep++;
+		wakeup(&xc->xc_donep);
 	}
 	/* NOTREACHED */
 }
 
 /*
- * xc_ipi_handler:
- *
- *	Handler of cross-call IPI.
+ * Run the high priority call pending for this cpu, if any.  Called
+ * from the cross-call IPI, from the idle loop when the call was
+ * posted through the mwait doorbell, and by xc_highpri() for the
+ * local cpu.
  */
 void
 xc_ipi_handler(void)
 {
-	/* Executes xc__highpri_intr() via software interrupt. */
-	softint_schedule(xc_sih);
-}
-
-/*
- * xc__highpri_intr:
- *
- *	A software interrupt handler for high priority calls.
- */
-void
-xc__highpri_intr(void *dummy)
-{
+	struct xc_cpu *xcc = &xc_cpus[CPU_INFO_UNIT(curcpu())];
 	xc_state_t *xc = &xc_high_pri;
-	void *arg1, *arg2;
-	xcfunc_t func;
+	int s;
+
+	if (atomic_cas_uint(&xcc->xcc_hipending, 1, 0) != 1)
+		return;
+
+	s = splipi();
 
-	KASSERT(!cpu_intr_p());
 	/*
 	 * Lock-less fetch of function and its arguments.
-	 * Safe since it cannot change at this point.
+	 * Safe since it cannot change until we are done.
 	 */
 	KASSERT(xc->xc_donep < xc->xc_headp);
-	func = xc->xc_func;
-	arg1 = xc->xc_arg1;
-	arg2 = xc->xc_arg2;
+	KASSERT(xc->xc_func != NULL);
+	(*xc->xc_func)(xc->xc_arg1, xc->xc_arg2);
 
-	KASSERT(func != NULL);
-	(*func)(arg1, arg2);
+	mtx_enter(&xc->xc_lock);
+	xc->xc_donep++;
+	mtx_leave(&xc->xc_lock);
 
-	/*
-	 * Note the request as done, and if we have reached the head,
-	 * cross-call has been processed - notify waiters, if any.
-	 */
-	mutex_enter(&xc->xc_lock);
-	if (++xc->xc_donep == xc->xc_headp) {
-		cv_broadcast(&xc->xc_busy);
-	}
-	mutex_exit(&xc->xc_lock);
+	splx(s);
 }
 
 /*
- * xc_highpri:
- *
- *	Trigger a high priority call on one or more CPUs.
+ * Trigger a high priority call on one or more cpus.
  */
-static inline uint64_t
+uint64_t
 xc_highpri(xcfunc_t func, void *arg1, void *arg2, struct cpu_info *ci)
 {
 	xc_state_t *xc = &xc_high_pri;
+	CPU_INFO_ITERATOR cii;
+	struct cpu_info *self = curcpu(), *target;
 	uint64_t where;
+	int local = 0;
 
-	mutex_enter(&xc->xc_lock);
+	/* Wait for the previous call to finish everywhere. */
+	mtx_enter(&xc->xc_lock);
 	while (xc->xc_headp != xc->xc_donep) {
-		cv_wait(&xc->xc_busy, &xc->xc_lock);
+		mtx_leave(&xc->xc_lock);
+		CPU_BUSY_CYCLE();
+		mtx_enter(&xc->xc_lock);
 	}
 	xc->xc_func = func;
 	xc->xc_arg1 = arg1;
 	xc->xc_arg2 = arg2;
-	xc->xc_headp += (ci ? 1 : ncpu);
+	if (ci == NULL) {
+		CPU_INFO_FOREACH(cii, target) {
+			if (!xc_cpu_ok(target))
+				continue;
+			xc->xc_headp++;
+			xc_cpus[CPU_INFO_UNIT(target)].xcc_hipending = 1;
+		}
+	} else {
+		xc->xc_headp++;
+		xc_cpus[CPU_INFO_UNIT(ci)].xcc_hipending = 1;
+	}
 	where = xc->xc_headp;
-	mutex_exit(&xc->xc_lock);
+	mtx_leave(&xc->xc_lock);
 
 	/*
-	 * Send the IPI once lock is released.
-	 * Note: it will handle the local CPU case.
+	 * Send the IPIs once lock is released, and handle the local
+	 * cpu without one.
 	 */
-
-#ifdef _RUMPKERNEL
-	rump_xc_highpri(ci);
-#else
 #ifdef MULTIPROCESSOR
-	kpreempt_disable();
-	if (curcpu() == ci) {
-		/* Unicast: local CPU. */
-		xc_ipi_handler();
-	} else if (ci) {
-		/* Unicast: remote CPU. */
+	if (ci == NULL) {
+		CPU_INFO_FOREACH(cii, target) {
+			if (!xc_cpu_ok(target))
+				continue;
+			if (target == self)
+				local = 1;
+			else
+				xc_send_ipi(target);
+		}
+	} else if (ci == self)
+		local = 1;
+	else
 		xc_send_ipi(ci);
-	} else {
-		/* Broadcast: all, including local. */
-		xc_send_ipi(NULL);
-		xc_ipi_handler();
-	}
-	kpreempt_enable();
 #else
-	KASSERT(ci == NULL || curcpu() == ci);
-	xc_ipi_handler();
-#endif
+	KASSERT(ci == NULL || ci == self);
+	local = 1;
 #endif
+	if (local)
+		xc_ipi_handler();
 
 	/* Indicate a high priority ticket. */
 	return (where | XC_PRI_BIT);
 }
-#endif // 0
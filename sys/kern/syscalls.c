@@ -277,11 +277,11 @@ char *syscallnames[] = {
 	"#232 (obsolete t32_clock_gettime)",		/* 232 = obsolete t32_clock_gettime */
 	"#233 (obsolete t32_clock_settime)",		/* 233 = obsolete t32_clock_settime */
 	"#234 (obsolete t32_clock_getres)",		/* 234 = obsolete t32_clock_getres */
-	"#235 (unimplemented timer_create)",		/* 235 = unimplemented timer_create */
-	"#236 (unimplemented timer_delete)",		/* 236 = unimplemented timer_delete */
-	"#237 (unimplemented timer_settime)",		/* 237 = unimplemented timer_settime */
-	"#238 (unimplemented timer_gettime)",		/* 238 = unimplemented timer_gettime */
-	"#239 (unimplemented timer_getoverrun)",		/* 239 = unimplemented timer_getoverrun */
+	"timer_create",			/* 235 = timer_create */
+	"timer_delete",			/* 236 = timer_delete */
+	"timer_settime",			/* 237 = timer_settime */
+	"timer_gettime",			/* 238 = timer_gettime */
+	"timer_getoverrun",			/* 239 = timer_getoverrun */
 	"#240 (obsolete t32_nanosleep)",		/* 240 = obsolete t32_nanosleep */
 	"#241 (unimplemented)",		/* 241 = unimplemented */
 	"#242 (unimplemented)",		/* 242 = unimplemented */
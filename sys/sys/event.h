@@ -38,8 +38,9 @@
 #define EVFILT_PROC		(-5)	/* attached to struct process */
 #define EVFILT_SIGNAL		(-6)	/* attached to struct process */
 #define EVFILT_TIMER		(-7)	/* timers */
+#define EVFILT_PTIMER		(-8)	/* attached to timer_create(2) timers */
 
-#define EVFILT_SYSCOUNT		7
+#define EVFILT_SYSCOUNT		8
 
 #define EV_SET(kevp, a, b, c, d, e, f) do {	\
 	(kevp)->ident = (a);			\
@@ -94,6 +95,17 @@ struct kevent {
 #define	NOTE_REVOKE	0x0040			/* vnode access was revoked */
 #define	NOTE_TRUNCATE   0x0080			/* vnode was truncated */
 
+/*
+ * data/hint flags for EVFILT_TIMER, shared with userspace
+ */
+#define	NOTE_SECONDS	0x0001			/* data is seconds */
+#define	NOTE_MSECONDS	0x0002			/* data is milliseconds */
+#define	NOTE_USECONDS	0x0004			/* data is microseconds */
+#define	NOTE_NSECONDS	0x0008			/* data is nanoseconds */
+#define	NOTE_ABSTIME	0x0010			/* data is an absolute time */
+#define	NOTE_TIMER_UNITMASK	(NOTE_SECONDS | NOTE_MSECONDS | \
+				 NOTE_USECONDS | NOTE_NSECONDS)
+
 /*
  * data/hint flags for EVFILT_PROC, shared with userspace
  */
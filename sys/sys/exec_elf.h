@@ -607,7 +607,7 @@ struct elfcore_procinfo {
 #if defined(_KERNEL) || defined(_DYN_LOADER)
 
 #define ELF32_NO_ADDR	((uint32_t) ~0)	/* Indicates addr. not yet filled in */
-#define ELF_AUX_ENTRIES	8		/* Size of aux array passed to loader */
+#define ELF_AUX_ENTRIES	9		/* Size of aux array passed to loader */
 
 typedef struct {
 	Elf32_Sword	au_id;				/* 32-bit id */
@@ -615,7 +615,7 @@ typedef struct {
 } Aux32Info;
 
 #define ELF64_NO_ADDR	((__uint64_t) ~0)/* Indicates addr. not yet filled in */
-#define ELF64_AUX_ENTRIES	8	/* Size of aux array passed to loader */
+#define ELF64_AUX_ENTRIES	9	/* Size of aux array passed to loader */
 
 typedef struct {
 	Elf64_Shalf	au_id;				/* 32-bit id */
@@ -636,7 +636,8 @@ enum AuxID {
 	AUX_sun_uid = 2000,		/* euid */
 	AUX_sun_ruid = 2001,		/* ruid */
 	AUX_sun_gid = 2002,		/* egid */
-	AUX_sun_rgid = 2003		/* rgid */
+	AUX_sun_rgid = 2003,		/* rgid */
+	AUX_openbsd_timekeep = 4000	/* userland clock_gettime */
 };
 
 struct elf_args {
@@ -83,6 +83,7 @@ struct	pgrp {
 struct exec_package;
 struct proc;
 struct ps_strings;
+struct ptimer;
 struct uvm_object;
 struct whitepaths;
 union sigval;
@@ -91,7 +92,7 @@ struct	emul {
 	char	e_name[8];		/* Symbolic name */
 	int	*e_errno;		/* Errno array */
 					/* Signal sending function */
-	void	(*e_sendsig)(void (*)(int), int, int, u_long, int, union sigval);
+	void	(*e_sendsig)(void (*)(int), int, int, const siginfo_t *);
 	int	e_nosys;		/* Offset of the nosys() syscall */
 	int	e_nsysent;		/* Number of system call entries */
 	struct sysent *e_sysent;	/* System call array */
@@ -128,6 +129,9 @@ struct tusage {
 	uint64_t	tu_uticks;	/* Statclock hits in user mode. */
 	uint64_t	tu_sticks;	/* Statclock hits in system mode. */
 	uint64_t	tu_iticks;	/* Statclock hits processing intr. */
+	uint64_t	tu_unsec;	/* Nanoseconds in user mode. */
+	uint64_t	tu_snsec;	/* Nanoseconds in system mode. */
+	uint64_t	tu_insec;	/* Nanoseconds processing intr. */
 };
 
 /*
@@ -188,6 +192,10 @@ struct process {
 	struct	tusage ps_tu;		/* accumulated times. */
 	struct	rusage ps_cru;		/* sum of stats for reaped children */
 	struct	itimerval ps_timer[3];	/* timers, indexed by ITIMER_* */
+	int	ps_realit_overrun;	/* ITIMER_REAL expirations merged */
+	int	ps_realit_sigpending;	/* ITIMER_REAL sent SIGALRM */
+	LIST_HEAD(, ptimer) ps_ptimers;	/* timer_create(2) timers */
+	u_int32_t ps_ptimer_ids;	/* timer ids in use */
 
 /* End area that is zeroed on creation. */
 #define	ps_endzero	ps_startcopy
@@ -200,8 +208,10 @@ struct process {
 	vaddr_t	ps_strings;		/* User pointers to argv/env */
 	vaddr_t	ps_stackgap;		/* User pointer to the "stackgap" */
 	vaddr_t	ps_sigcode;		/* User pointer to the signal code */
+	vaddr_t	ps_timekeep;		/* User pointer to the timekeep page */
 	u_int	ps_rtableid;		/* Process routing table/domain. */
 	char	ps_nice;		/* Process "nice" value. */
+	u_int	ps_timerslack;		/* nsec a timed sleep may run late */
 
 	struct uprof {			/* profile arguments */
 		caddr_t	pr_base;	/* buffer base */
@@ -230,6 +240,9 @@ struct process {
 #define	ps_session	ps_pgrp->pg_session
 #define	ps_pgid		ps_pgrp->pg_id
 
+#define	TIMERSLACK_DEFAULT	50000	/* ps_timerslack of process0, nsec */
+#define	TIMERSLACK_MAX		1000000000
+
 #endif /* __need_process */
 
 /*
@@ -303,7 +316,13 @@ struct proc {
 	u_int	p_uticks;		/* Statclock hits in user mode. */
 	u_int	p_sticks;		/* Statclock hits in system mode. */
 	u_int	p_iticks;		/* Statclock hits processing intr. */
+	uint64_t p_unsec;		/* Nanoseconds in user mode. */
+	uint64_t p_snsec;		/* Nanoseconds in system mode. */
+	uint64_t p_insec;		/* Nanoseconds processing intr. */
+	u_int	p_itcarry[2];		/* Virtual/prof itimer nsec carry. */
 	struct	cpu_info * volatile p_cpu; /* CPU we're running on. */
+	struct	cpu_info * volatile p_oncpu; /* CPU not done switching
+					      * away from us, or NULL. */
 
 	struct	rusage p_ru;		/* Statistics */
 	struct	tusage p_tu;		/* accumulated times. */
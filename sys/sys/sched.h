@@ -70,6 +70,7 @@
 #define	_SYS_SCHED_H_
 
 #include <sys/queue.h>
+#include <sys/mutex.h>
 
 /*
  * Posix defines a <sched.h> which may want to include <sys/sched.h>
@@ -87,8 +88,22 @@
 #define CP_IDLE		4
 #define CPUSTATES	5
 
+/*
+ * Per-CPU clock events.  Deadlines are in nanoseconds of uptime and
+ * the clock interrupt is programmed for the earliest armed one.
+ */
+#define CLKEV_HARDCLOCK		0
+#define CLKEV_STATCLOCK		1
+#define CLKEV_ROUNDROBIN	2
+#define CLKEV_TIMEOUT		3
+#define CLKEV_ITIMER		4
+#define CLKEV_NEVENTS		5
+#define CLKEV_NONE		0xffffffffffffffffULL	/* not armed */
+
 #define	SCHED_NQS	32			/* 32 run queues. */
 
+struct timeout_wheel;
+
 /*
  * Per-CPU scheduler state.
  * XXX - expose to userland for now.
@@ -97,15 +112,24 @@ struct schedstate_percpu {
 	struct timespec spc_runtime;	/* time curproc started running */
 	volatile int spc_schedflags;	/* flags; see below */
 	u_int spc_schedticks;		/* ticks for schedclock() */
-	u_int64_t spc_cp_time[CPUSTATES]; /* CPU state statistics */
+	u_int64_t spc_cp_time[CPUSTATES]; /* CPU state samples */
+	u_int64_t spc_cp_nsec[CPUSTATES]; /* nsec timed in each state */
+	u_int64_t spc_cp_stamp;		/* uptime of last state change, or 0 */
+	int spc_cp_state;		/* current CP_* state */
 	u_char spc_curpriority;		/* usrpri of curproc */
-	int spc_rrticks;		/* ticks until roundrobin() */
+	u_int64_t spc_rrdeadline;	/* end of curproc's quantum */
+	u_int64_t spc_itdeadline;	/* armed CLKEV_ITIMER deadline */
+	int spc_missedticks;		/* ticks skipped while tickless */
 	int spc_pscnt;			/* prof/stat counter */
 	int spc_psdiv;			/* prof/stat divisor */	
 	struct proc *spc_idleproc;	/* idle proc for this cpu */
+	struct proc *spc_prevproc;	/* proc cpu_switchto() is leaving */
 
+	struct mutex spc_mtx;		/* protects the run queues */
 	u_int spc_nrun;			/* procs on the run queues */
 	fixpt_t spc_ldavg;		/* shortest load avg. for this cpu */
+	u_int spc_pkg_id;		/* package, see sched_topology() */
+	u_int spc_core_id;		/* core within the package */
 
 	TAILQ_HEAD(prochead, proc) spc_qs[SCHED_NQS];
 	volatile uint32_t spc_whichqs;
@@ -116,28 +140,40 @@ struct schedstate_percpu {
 	LIST_HEAD(,proc) spc_deadproc;
 
 	volatile int spc_barrier;	/* for sched_barrier() */
+
+	struct timeout_wheel *spc_wheel; /* this cpu's timeouts */
 };
 
 #ifdef	_KERNEL
 
 /* spc_flags */
-#define SPCF_SEENRR             0x0001  /* process has seen roundrobin() */
 #define SPCF_SHOULDYIELD        0x0002  /* process should yield the CPU */
-#define SPCF_SWITCHCLEAR        (SPCF_SEENRR|SPCF_SHOULDYIELD)
+#define SPCF_SWITCHCLEAR        SPCF_SHOULDYIELD
 #define SPCF_SHOULDHALT		0x0004	/* CPU should be vacated */
 #define SPCF_HALTED		0x0008	/* CPU has been halted */
+#define SPCF_TICKLESS		0x0010	/* CPU clock is stopped */
+#define SPCF_DYNTICKS		0x0020	/* clock stopped under curproc */
+#define SPCF_DYNSTALE		0x0040	/* dynticks period must be redone */
+#define SPCF_RRARM		0x0080	/* spc_rrdeadline is not armed yet */
+
+/* sched_topology_level() */
+#define SCHED_TOPO_CPU		0	/* the same cpu */
+#define SCHED_TOPO_CORE		1	/* SMT siblings, sharing L1 and L2 */
+#define SCHED_TOPO_PKG		2	/* same package, sharing L3 */
+#define SCHED_TOPO_SYSTEM	3	/* anywhere else */
 
 #define	SCHED_PPQ	(128 / SCHED_NQS)	/* priorities per queue */
 #define NICE_WEIGHT 2			/* priorities per nice level */
 #define	ESTCPULIM(e) min((e), NICE_WEIGHT * PRIO_MAX - SCHED_PPQ)
 
 extern int schedhz;			/* ideally: 16 */
-extern int rrticks_init;		/* ticks per roundrobin() */
+extern u_int64_t rrquantum;		/* nsec per roundrobin() quantum */
 
 struct proc;
 void schedclock(struct proc *);
 struct cpu_info;
 void roundrobin(struct cpu_info *);
+void roundrobin_arm(struct cpu_info *);
 void scheduler_start(void);
 void updatepri(struct proc *);
 void userret(struct proc *p);
@@ -154,7 +190,10 @@ void cpu_idle_enter(void);
 void cpu_idle_cycle(void);
 void cpu_idle_leave(void);
 void sched_peg_curproc(struct cpu_info *ci);
+void sched_topology(struct cpu_info *, u_int, u_int);
+int sched_topology_level(struct cpu_info *, struct cpu_info *);
 void sched_barrier(struct cpu_info *ci);
+void sched_switched(void);
 
 int sysctl_hwsetperf(void *, size_t *, void *, size_t);
 int sysctl_hwperfpolicy(void *, size_t *, void *, size_t);
@@ -168,7 +207,7 @@ void sched_stop_secondary_cpus(void);
 
 void sched_init_runqueues(void);
 void setrunqueue(struct proc *);
-void remrunqueue(struct proc *);
+void sched_setpriority(struct proc *, u_char);
 
 /* Inherit the parent's scheduler history */
 #define scheduler_fork_hook(parent, child) do {				\
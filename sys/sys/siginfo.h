@@ -149,6 +149,11 @@ typedef struct {
 				} _cld;
 			} _pdata;
 		} _proc;
+		struct {			/* SI_TIMER */
+			int	_timerid;	/* timer_create(2) id */
+			int	_overrun;	/* expirations merged */
+			/* si_value as for kill() */
+		} _timer;
 		struct {	/* SIGSEGV, SIGBUS, SIGILL and SIGFPE */
 			caddr_t	_addr;		/* faulting address */
 			int	_trapno;	/* illegal trap number */
@@ -179,6 +184,8 @@ typedef struct {
 #define si_utime	_data._proc._pdata._cld._utime
 #define si_uid		_data._proc._pdata._kill._uid
 #define si_value	_data._proc._pdata._kill._value
+#define si_timerid	_data._timer._timerid
+#define si_overrun	_data._timer._overrun
 #define si_addr		_data._fault._addr
 #define si_trapno	_data._fault._trapno
 #define si_fd		_data._file._fd
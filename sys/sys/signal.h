@@ -140,6 +140,27 @@ struct	sigaction {
 #define	SIG_BLOCK	1	/* block specified signal set */
 #define	SIG_UNBLOCK	2	/* unblock specified signal set */
 #define	SIG_SETMASK	3	/* set specified signal set */
+
+#if __POSIX_VISIBLE >= 199309 || __XPG_VISIBLE >= 500
+/*
+ * How a timer_create(2) timer notifies its expiration.
+ */
+struct	sigevent {
+	int	sigev_notify;		/* notification type, see below */
+	int	sigev_signo;		/* signal to send */
+	union sigval sigev_value;	/* value passed along */
+	void	(*sigev_notify_function)(union sigval);
+	void	*sigev_notify_attributes; /* pthread_attr_t for the above */
+	int	sigev_notify_kqueue;	/* kqueue to post an event to */
+};
+
+#define SIGEV_NONE	0	/* no notification */
+#define SIGEV_SIGNAL	1	/* send sigev_signo with sigev_value */
+#define SIGEV_THREAD	2	/* call sigev_notify_function, in libc */
+#if __BSD_VISIBLE
+#define SIGEV_KEVENT	3	/* post EVFILT_PTIMER to sigev_notify_kqueue */
+#endif
+#endif
 #endif	/* __POSIX_VISIBLE || __XPG_VISIBLE */
 
 #if __BSD_VISIBLE
@@ -171,10 +171,13 @@ void	sigstkinit(struct sigaltstack *);
 void	sigactsunshare(struct process *);
 void	sigactsfree(struct process *);
 
+void	ptimer_init(void);
+void	timer_siginfo(struct process *, siginfo_t *);
+void	ptimer_deleteall(struct proc *);
+
 /*
  * Machine-dependent functions:
  */
-void	sendsig(sig_t action, int sig, int returnmask, u_long code,
-	    int type, union sigval val);
+void	sendsig(sig_t action, int sig, int returnmask, const siginfo_t *si);
 #endif	/* _KERNEL */
 #endif	/* !_SYS_SIGNALVAR_H_ */
@@ -535,6 +535,21 @@
 				/* 232 is obsolete t32_clock_gettime */
 				/* 233 is obsolete t32_clock_settime */
 				/* 234 is obsolete t32_clock_getres */
+/* syscall: "timer_create" ret: "int" args: "clockid_t" "const struct sigevent *" "timer_t *" */
+#define	SYS_timer_create	235
+
+/* syscall: "timer_delete" ret: "int" args: "timer_t" */
+#define	SYS_timer_delete	236
+
+/* syscall: "timer_settime" ret: "int" args: "timer_t" "int" "const struct itimerspec *" "struct itimerspec *" */
+#define	SYS_timer_settime	237
+
+/* syscall: "timer_gettime" ret: "int" args: "timer_t" "struct itimerspec *" */
+#define	SYS_timer_gettime	238
+
+/* syscall: "timer_getoverrun" ret: "int" args: "timer_t" */
+#define	SYS_timer_getoverrun	239
+
 				/* 240 is obsolete t32_nanosleep */
 /* syscall: "minherit" ret: "int" args: "void *" "size_t" "int" */
 #define	SYS_minherit	250
@@ -847,6 +847,32 @@ struct sys_shmdt_args {
 	syscallarg(const void *) shmaddr;
 };
 
+struct sys_timer_create_args {
+	syscallarg(clockid_t) clock_id;
+	syscallarg(const struct sigevent *) evp;
+	syscallarg(timer_t *) timerid;
+};
+
+struct sys_timer_delete_args {
+	syscallarg(timer_t) timerid;
+};
+
+struct sys_timer_settime_args {
+	syscallarg(timer_t) timerid;
+	syscallarg(int) flags;
+	syscallarg(const struct itimerspec *) value;
+	syscallarg(struct itimerspec *) ovalue;
+};
+
+struct sys_timer_gettime_args {
+	syscallarg(timer_t) timerid;
+	syscallarg(struct itimerspec *) value;
+};
+
+struct sys_timer_getoverrun_args {
+	syscallarg(timer_t) timerid;
+};
+
 struct sys_minherit_args {
 	syscallarg(void *) addr;
 	syscallarg(size_t) len;
@@ -1283,6 +1309,11 @@ int	sys_shmat(struct proc *, void *, register_t *);
 int	sys_shmdt(struct proc *, void *, register_t *);
 #else
 #endif
+int	sys_timer_create(struct proc *, void *, register_t *);
+int	sys_timer_delete(struct proc *, void *, register_t *);
+int	sys_timer_settime(struct proc *, void *, register_t *);
+int	sys_timer_gettime(struct proc *, void *, register_t *);
+int	sys_timer_getoverrun(struct proc *, void *, register_t *);
 int	sys_minherit(struct proc *, void *, register_t *);
 int	sys_poll(struct proc *, void *, register_t *);
 int	sys_issetugid(struct proc *, void *, register_t *);
@@ -184,7 +184,9 @@ struct ctlname {
 #define	KERN_GLOBAL_PTRACE	81	/* allow ptrace globally */
 #define	KERN_CONSBUFSIZE	82	/* int: console message buffer size */
 #define	KERN_CONSBUF		83	/* console message buffer */
-#define	KERN_MAXID		84	/* number of valid kern ids */
+#define	KERN_DYNTICKS		84	/* quad: cpus allowed in dynticks */
+#define	KERN_PROC_TIMERSLACK	85	/* node: proc timer slack */
+#define	KERN_MAXID		86	/* number of valid kern ids */
 
 #define	CTL_KERN_NAMES { \
 	{ 0, 0 }, \
@@ -269,6 +271,10 @@ struct ctlname {
 	{ "proc_nobroadcastkill", CTLTYPE_NODE }, \
 	{ "proc_vmmap", CTLTYPE_NODE }, \
 	{ "global_ptrace", CTLTYPE_INT }, \
+	{ "consbufsize", CTLTYPE_INT }, \
+	{ "consbuf", CTLTYPE_STRUCT }, \
+	{ "dynticks", CTLTYPE_QUAD }, \
+	{ "proc_timerslack", CTLTYPE_NODE }, \
 }
 
 /*
@@ -947,6 +953,7 @@ struct walkarg;
 int sysctl_dumpentry(struct rtentry *, void *, unsigned int);
 int sysctl_rtable(int *, u_int, void *, size_t *, void *, size_t);
 int sysctl_clockrate(char *, size_t *, void *);
+int sysctl_dynticks(void *, size_t *, void *, size_t);
 int sysctl_vnode(char *, size_t *, struct proc *);
 #ifdef GPROF
 int sysctl_doprof(int *, u_int, void *, size_t *, void *, size_t);
@@ -227,14 +227,27 @@ int	tstohz(const struct timespec *);
 void	realitexpire(void *);
 
 struct clockframe;
+struct cpu_info;
 void	hardclock(struct clockframe *);
 void	softclock(void *);
 void	statclock(struct clockframe *);
+void	tickless_idle_enter(struct cpu_info *);
+void	tickless_idle_leave(struct cpu_info *);
+void	dynticks_update(struct proc *);
+void	dynticks_leave(struct cpu_info *, struct proc *);
+void	dynticks_kick(struct cpu_info *);
+void	clockev_expire(struct cpu_info *, int);
+int	cpustate_switch(int);
+void	cpustate_cp_time(struct cpu_info *, u_int64_t *);
 
 void	initclocks(void);
 void	inittodr(time_t);
 void	resettodr(void);
 void	cpu_initclocks(void);
+int	cpu_tickless_enter(int);
+int	cpu_tickless_leave(void);
+int	cpu_clockev_arm(int, uint64_t);
+uint64_t cpu_clockev_res(void);
 
 void	startprofclock(struct process *);
 void	stopprofclock(struct process *);
@@ -244,6 +257,7 @@ struct sleep_state;
 void	sleep_setup(struct sleep_state *, const volatile void *, int,
 	    const char *);
 void	sleep_setup_timeout(struct sleep_state *, int);
+void	sleep_setup_deadline(struct sleep_state *, uint64_t);
 void	sleep_setup_signal(struct sleep_state *, int);
 void	sleep_finish(struct sleep_state *, int);
 int	sleep_finish_timeout(struct sleep_state *);
@@ -255,6 +269,7 @@ void    wakeup_n(const volatile void *, int);
 void    wakeup(const volatile void *);
 #define wakeup_one(c) wakeup_n((c), 1)
 int	tsleep(const volatile void *, int, const char *, int);
+int	tsleep_until(const volatile void *, int, const char *, uint64_t);
 int	msleep(const volatile void *, struct mutex *, int,  const char*, int);
 void	yield(void);
 
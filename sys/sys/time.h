@@ -154,10 +154,6 @@ struct clockinfo {
 	int	stathz;		/* statistics clock frequency */
 	int	profhz;		/* profiling clock frequency */
 };
-#endif /* __BSD_VISIBLE */
-
-#if defined(_KERNEL) || defined(_STANDALONE)
-#include <sys/_time.h>
 
 /* Time expressed as seconds and fractions of a second + operations on it. */
 struct bintime {
@@ -165,6 +161,34 @@ struct bintime {
 	uint64_t frac;
 };
 
+/*
+ * Timekeeping data of the kernel, mapped read-only into every process
+ * at exec and found through AUX_openbsd_timekeep.  If tk_user says how
+ * to read the timecounter, userland can tell the time on its own:
+ *
+ *	uptime = tk_offset +
+ *	    tk_scale * ((count - tk_offset_count) & tk_counter_mask)
+ *
+ * plus tk_boottime for the time of day or minus tk_naptime for
+ * CLOCK_UPTIME, retrying while tk_generation is 0 or changes meanwhile.
+ */
+struct timekeep {
+	u_int		tk_version;	/* TK_VERSION */
+	volatile u_int	tk_generation;	/* 0 while being updated */
+	uint64_t	tk_scale;	/* 2^-64 s per counter tick */
+	u_int		tk_offset_count; /* counter value at tk_offset */
+	u_int		tk_counter_mask; /* implemented counter bits */
+	struct bintime	tk_offset;	/* uptime at tk_offset_count */
+	struct bintime	tk_naptime;	/* time spent suspended */
+	struct bintime	tk_boottime;	/* time of day at zero uptime */
+	u_int		tk_user;	/* MD counter to read, 0 if none */
+};
+#define	TK_VERSION	0
+#endif /* __BSD_VISIBLE */
+
+#if defined(_KERNEL) || defined(_STANDALONE)
+#include <sys/_time.h>
+
 static __inline void
 bintime_addx(struct bintime *bt, uint64_t x)
 {
@@ -248,6 +272,44 @@ timeval2bintime(struct timeval *tv, struct bintime *bt)
 	bt->frac = (uint64_t)tv->tv_usec * (uint64_t)18446744073709ULL;
 }
 
+static __inline uint64_t
+bintime2nsec(const struct bintime *bt)
+{
+	return ((uint64_t)bt->sec * 1000000000ULL +
+	    (((uint64_t)1000000000 * (uint32_t)(bt->frac >> 32)) >> 32));
+}
+
+static __inline uint64_t
+TIMESPEC_TO_NSEC(const struct timespec *ts)
+{
+	if (ts->tv_sec > (0xffffffffffffffffULL - ts->tv_nsec) / 1000000000ULL)
+		return (0xffffffffffffffffULL);
+	return (ts->tv_sec * 1000000000ULL + ts->tv_nsec);
+}
+
+static __inline void
+NSEC_TO_TIMESPEC(uint64_t ns, struct timespec *ts)
+{
+	ts->tv_sec = ns / 1000000000ULL;
+	ts->tv_nsec = ns % 1000000000ULL;
+}
+
+static __inline uint64_t
+TIMEVAL_TO_NSEC(const struct timeval *tv)
+{
+	if (tv->tv_sec > (0xffffffffffffffffULL - tv->tv_usec * 1000ULL) /
+	    1000000000ULL)
+		return (0xffffffffffffffffULL);
+	return (tv->tv_sec * 1000000000ULL + tv->tv_usec * 1000ULL);
+}
+
+static __inline void
+NSEC_TO_TIMEVAL(uint64_t ns, struct timeval *tv)
+{
+	tv->tv_sec = ns / 1000000000ULL;
+	tv->tv_usec = (ns % 1000000000ULL) / 1000;
+}
+
 extern volatile time_t time_second;	/* Seconds since epoch, wall time. */
 extern volatile time_t time_uptime;	/* Seconds since reboot. */
 
@@ -286,12 +348,23 @@ void	microuptime(struct timeval *);
 void	getnanouptime(struct timespec *);
 void	getmicrouptime(struct timeval *);
 
+uint64_t nsecuptime(void);
+
 struct proc;
 int	clock_gettime(struct proc *, clockid_t, struct timespec *);
+uint64_t clock_resolution(int);
+
+/*
+ * Shortest period a periodic timer really fires at, in nanoseconds.
+ * Expirations in between are counted, not delivered one by one.
+ */
+#define	TIMER_MINPERIOD	1000
 
 int	timespecfix(struct timespec *);
 int	itimerfix(struct timeval *);
 int	itimerdecr(struct itimerval *itp, int usec);
+int	itimercharge(struct proc *, int, uint64_t);
+uint64_t itimerleft(struct proc *, int);
 void	itimerround(struct timeval *);
 int	settime(struct timespec *);
 int	ratecheck(struct timeval *, const struct timeval *);
@@ -38,19 +38,36 @@
  *  - timeout_set(timeout, function, argument)
  *      Initializes a timeout struct to call the function with the argument.
  *      A timeout only needs to be initialized once.
+ *  - timeout_set_flags(timeout, function, argument, flags)
+ *      Like timeout_set, with flags.  TIMEOUT_DEFERRABLE marks a timeout
+ *      that need not wake up an idle cpu; it runs late rather than early.
  *  - timeout_add(timeout, ticks)
  *      Schedule this timeout to run in "ticks" ticks (there are hz ticks in
  *      one second). You may not touch the timeout with timeout_set once the
  *      timeout is scheduled. A second call to timeout_add with an already
  *      scheduled timeout will cause the old timeout to be canceled and the
  *      new will be scheduled.
+ *  - timeout_add_slack(timeout, ticks, slack)
+ *      Like timeout_add, but the timeout may run up to "slack" ticks late.
+ *      The wheel uses this to run it together with other timeouts.
+ *  - timeout_at_ts(timeout, timespec)
+ *      Schedule this timeout to run at an absolute time of uptime, as
+ *      returned by nanouptime(). It is run from the cpu's one-shot event
+ *      timer rather than at the next tick, if there is such a timer.
+ *  - timeout_at_nsec_slack(timeout, nsec, slack)
+ *      Like timeout_at_ts with a deadline in nanoseconds of uptime, but
+ *      the timeout may run up to "slack" nanoseconds late, so that it
+ *      can share an event with others.
  *  - timeout_del(timeout)
  *      Remove the timeout from the timeout queue. It's legal to remove
  *      a timeout that has already happened.
  *
  * These functions may be called in interrupt context (anything below splhigh).
+ * Timeouts are run by the softclock of the cpu that added them last.
  */
 
+struct timeout_wheel;
+
 struct circq {
 	struct circq *next;		/* next element */
 	struct circq *prev;		/* previous element */
@@ -62,6 +79,8 @@ struct timeout {
 	void *to_arg;				/* function argument */
 	int to_time;				/* ticks on event */
 	int to_flags;				/* misc flags */
+	uint64_t to_nsec;			/* uptime on event */
+	struct timeout_wheel *to_wheel;		/* cpu wheel it belongs to */
 };
 
 /*
@@ -70,6 +89,8 @@ struct timeout {
 #define TIMEOUT_ONQUEUE		2	/* timeout is on the todo queue */
 #define TIMEOUT_INITIALIZED	4	/* timeout is initialized */
 #define TIMEOUT_TRIGGERED	8	/* timeout is running or ran */
+#define TIMEOUT_NSEC		16	/* timeout is on the deadline queue */
+#define TIMEOUT_DEFERRABLE	32	/* timeout may wait for a wakeup */
 
 #ifdef _KERNEL
 /*
@@ -82,13 +103,19 @@ struct timeout {
 #define timeout_initialized(to) ((to)->to_flags & TIMEOUT_INITIALIZED)
 #define timeout_triggered(to) ((to)->to_flags & TIMEOUT_TRIGGERED)
 
-#define TIMEOUT_INITIALIZER(_f, _a) \
-	{ { NULL, NULL }, (_f), (_a), 0, TIMEOUT_INITIALIZED }
+#define TIMEOUT_INITIALIZER_FLAGS(_f, _a, _fl) \
+	{ { NULL, NULL }, (_f), (_a), 0, (_fl) | TIMEOUT_INITIALIZED, 0, NULL }
+
+#define TIMEOUT_INITIALIZER(_f, _a) TIMEOUT_INITIALIZER_FLAGS((_f), (_a), 0)
 
 struct bintime;
+struct timespec;
+struct cpu_info;
 
 void timeout_set(struct timeout *, void (*)(void *), void *);
+void timeout_set_flags(struct timeout *, void (*)(void *), void *, int);
 int timeout_add(struct timeout *, int);
+int timeout_add_slack(struct timeout *, int, int);
 int timeout_add_tv(struct timeout *, const struct timeval *);
 int timeout_add_ts(struct timeout *, const struct timespec *);
 int timeout_add_bt(struct timeout *, const struct bintime *);
@@ -96,13 +123,23 @@ int timeout_add_sec(struct timeout *, int);
 int timeout_add_msec(struct timeout *, int);
 int timeout_add_usec(struct timeout *, int);
 int timeout_add_nsec(struct timeout *, int);
+int timeout_at_ts(struct timeout *, const struct timespec *);
+int timeout_at_nsec(struct timeout *, uint64_t);
+int timeout_at_nsec_slack(struct timeout *, uint64_t, uint64_t);
 int timeout_del(struct timeout *);
 
 void timeout_startup(void);
+void timeout_startup_cpu(struct cpu_info *);
 void timeout_adjust_ticks(int);
+void timeout_migrate(struct cpu_info *);
+int timeout_next_expiry(struct cpu_info *);
+
+void softclock_init(void);
+void softclock_schedule(void);
+void timeout_nsec_expire(void);
 
 /*
- * called once every hardclock. returns non-zero if we need to schedule a
+ * called once every hardclock on every cpu. returns non-zero if we need to schedule a
  * softclock.
  */
 int timeout_hardclock_update(void);
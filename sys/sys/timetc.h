@@ -75,15 +75,24 @@ struct timecounter {
 		/* Pointer to the next timecounter. */
 	int64_t			tc_freq_adj;
 		/* Current frequency adjustment. */
+	u_int			tc_user;
+		/*
+		 * How userland reads the counter, see struct timekeep.
+		 * 0 if it can't.
+		 */
 };
 
 extern struct timecounter *timecounter;
+extern struct timekeep *timekeep;
 
 u_int64_t tc_getfrequency(void);
 void	tc_init(struct timecounter *tc);
+void	tc_reset_quality(struct timecounter *, int);
 void	tc_setclock(struct timespec *ts);
 void	tc_setrealtimeclock(struct timespec *ts);
-void	tc_ticktock(void);
+void	tc_ticktock(int);
+void	tc_update_timekeep(void);
+u_int64_t tc_wrap_nsec(void);
 void	inittimecounter(void);
 int	sysctl_tc(int *, u_int, void *, size_t *, void *, size_t);
 int	tc_adjfreq(int64_t *, int64_t *);
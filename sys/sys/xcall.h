@@ -1,4 +1,4 @@
-/*	$NetBSD$	*/
+/*	$OpenBSD$	*/
 
 /*-
  * Copyright (c) 2007 The NetBSD Foundation, Inc.
@@ -43,8 +43,6 @@ void		xc_init_cpu(struct cpu_info *);
 void		xc_send_ipi(struct cpu_info *);
 void		xc_ipi_handler(void);
 
-void		xc__highpri_intr(void *);
-
 uint64_t	xc_broadcast(u_int, xcfunc_t, void *, void *);
 uint64_t	xc_unicast(u_int, xcfunc_t, void *, void *, struct cpu_info *);
 void		xc_wait(uint64_t);